@@ -0,0 +1,276 @@
+#define _DEFAULT_SOURCE
+#include <getopt.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <time.h>
+#include "aggregate.h"
+#include "parse.h"
+#include "sketch.h"
+#include "utils.h"
+
+// Headless driver which pushes synthetic events through the same stages as the graph:
+// parsing of ecli's output, grouping, syncing into the drawn graph, projection of the points to pixels and stats.
+
+static const uint64_t NS_IN_S = 1000000000;
+static const int READS_PER_S = 10;  // same as the ingestion thread's timeout
+static const int LINE_SIZE = 96;
+static const int CPUS = 64;
+static const uint32_t S_IN_DAY = 86400;
+
+typedef struct {
+    int cgroups;
+    long events;
+    long rate;  // events per second of the simulated time
+    double preempt_ratio;
+    int max_points;
+    int width;
+} Options;
+
+typedef enum { STAGE_PARSE, STAGE_GROUP, STAGE_SYNC, STAGE_PROJECT, STAGE_STATS, STAGES_COUNT } Stage;
+
+static const char *STAGE_NAMES[STAGES_COUNT] = {"parse", "group", "sync", "project", "stats"};
+
+VECTOR_TYPEDEF(DurationVec, uint64_t);
+
+typedef struct {
+    uint64_t total_ns;
+    DurationVec durations_ns;  // of each read, sorted at the end for exact percentiles
+} StageStats;
+
+static uint64_t rng_state = 0x9E3779B97F4A7C15ULL;
+
+static uint64_t rng(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+static uint64_t get_time_ns(void) {
+    struct timespec ts;
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1) ERROR("unable to get monotonic time.");
+    return ts.tv_sec * NS_IN_S + ts.tv_nsec;
+}
+
+static void add_stage_time(StageStats *stats, uint64_t start_ns) {
+    uint64_t time_ns = get_time_ns() - start_ns;
+    stats->total_ns += time_ns;
+    VECTOR_PUSH(&stats->durations_ns, time_ns);
+}
+
+static int compare_durations(const void *a, const void *b) {
+    uint64_t lhs = *(const uint64_t *) a;
+    uint64_t rhs = *(const uint64_t *) b;
+    return (lhs > rhs) - (lhs < rhs);
+}
+
+// Nearest rank of the sorted durations
+static uint64_t get_percentile(const DurationVec *durations_ns, double percentile) {
+    if (durations_ns->length == 0) return 0;
+    int rank = ceil(percentile * durations_ns->length);
+    return durations_ns->data[MAX(rank, 1) - 1];
+}
+
+// Writes events in ecli's format, latencies are spread over a few orders of magnitude
+static int generate_lines(char *text, int count, uint64_t *ktime_ns, uint64_t step_ns, const Options *options) {
+    int length = 0;
+    for (int i = 0; i < count; i++) {
+        uint32_t time_s = *ktime_ns / NS_IN_S;
+        uint64_t cgroup_id = 1 + rng() % options->cgroups;
+        uint64_t latency_ns = (1000 + rng() % 1000) << (rng() % 8);
+        int preempts = (rng() % 1000) < options->preempt_ratio * 1000;
+        int cpu = rng() % CPUS;
+
+        length += snprintf(text + length, LINE_SIZE, "%02u:%02u:%02u %d %lu %lu %lu %d 1\n", (time_s / 3600) % 24,
+                           (time_s / 60) % 60, time_s % 60, preempts, cgroup_id, latency_ns, *ktime_ns, cpu);
+        *ktime_ns += step_ns;
+    }
+    return length;
+}
+
+// Mirrors build_series_lines: picks the granularity and level of detail, finds the first visible point and projects
+// the rest to pixels
+static double project(const Graph *graph, int width) {
+    int granularity = get_granularity_for(graph, graph->min_ktime_ns);
+    double ktime_per_px = (graph->max_ktime_ns - graph->min_ktime_ns) / ((double) width);
+    double points_per_px = ktime_per_px / GRANULARITIES[granularity].point_ns;
+
+    double checksum = 0;
+    for (int i = 0; i < graph->cgroups.length; i++) {
+        const Series *cgroup_series = &graph->cgroups.data[i].series[granularity];
+
+        const void *series = &cgroup_series->latencies;
+        int length = cgroup_series->latencies.length;
+        LodGetPoint get_point = get_latency_lod_point;
+        int level = lod_level_for(&cgroup_series->latency_lod, points_per_px);
+        if (level != -1) {
+            series = &cgroup_series->latency_lod.levels[level];
+            length = cgroup_series->latency_lod.levels[level].length;
+            get_point = get_lod_level_point;
+        }
+
+        int start = MAX(lod_find(series, length, get_point, graph->min_ktime_ns) - 1, 0);
+        for (int j = start; j < length; j++) {
+            LodPoint point = get_point(series, j);
+            double x = (point.ktime_ns - graph->min_ktime_ns) / ktime_per_px;
+            if (x > width) break;
+            checksum += x + point.total / ((double) point.points);
+            // Envelope of the aggregated points
+            if (level != -1) checksum += point.max - point.min;
+        }
+    }
+    return checksum;
+}
+
+// Mirrors update_stats for the whole graph
+static double query_stats(const Graph *graph) {
+    int granularity = get_granularity_for(graph, graph->min_ktime_ns);
+
+    double checksum = 0;
+    for (int i = 0; i < graph->cgroups.length; i++) {
+        const Series *series = &graph->cgroups.data[i].series[granularity];
+        const LatencyVec *latencies = &series->latencies;
+
+        int from = lod_find(latencies, latencies->length, get_latency_lod_point, graph->min_ktime_ns);
+        int to = lod_find(latencies, latencies->length, get_latency_lod_point, graph->max_ktime_ns + 1);
+        LodPoint stats = lod_query(&series->latency_lod, latencies, get_latency_lod_point, from, to);
+        checksum += stats.total;
+
+        const Series *sketch_series = &graph->cgroups.data[i].series[MAX(granularity, FIRST_SKETCH_GRANULARITY)];
+        latencies = &sketch_series->latencies;
+        from = lod_find(latencies, latencies->length, get_latency_lod_point, graph->min_ktime_ns);
+        to = lod_find(latencies, latencies->length, get_latency_lod_point, graph->max_ktime_ns + 1);
+        Sketch sketch = lod_query_sketch(&sketch_series->latency_lod, &sketch_series->sketches, from, to);
+        checksum += sketch_quantile(&sketch, 0.99);
+        sketch_free(&sketch);
+    }
+    return checksum;
+}
+
+static void usage(const char *program) {
+    fprintf(stderr, "Usage: %s [-c cgroups] [-n events] [-r rate] [-p ratio] [-m points] [-w width]\n", program);
+    fprintf(stderr, "  -c cgroups  number of cgroups (default: 100)\n");
+    fprintf(stderr, "  -n events   total number of events (default: 10000000)\n");
+    fprintf(stderr, "  -r rate     events per second of the simulated time (default: 1000000)\n");
+    fprintf(stderr, "  -p ratio    ratio of events which are preemptions (default: 0.1)\n");
+    fprintf(stderr, "  -m points   max number of points per series (default: %d)\n", DEFAULT_RETENTION_POINTS);
+    fprintf(stderr, "  -w width    width of the projected graph in pixels (default: 1600)\n");
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv) {
+    Options options = {
+        .cgroups = 100,
+        .events = 10000000,
+        .rate = 1000000,
+        .preempt_ratio = 0.1,
+        .max_points = DEFAULT_RETENTION_POINTS,
+        .width = 1600,
+    };
+
+    int opt;
+    while ((opt = getopt(argc, argv, "c:n:r:p:m:w:")) != -1) {
+        switch (opt) {
+            case 'c':
+                options.cgroups = atoi(optarg);
+                break;
+            case 'n':
+                options.events = atol(optarg);
+                break;
+            case 'r':
+                options.rate = atol(optarg);
+                break;
+            case 'p':
+                options.preempt_ratio = atof(optarg);
+                break;
+            case 'm':
+                options.max_points = atoi(optarg);
+                break;
+            case 'w':
+                options.width = atoi(optarg);
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+    if (optind != argc) usage(argv[0]);
+    if (options.cgroups <= 0 || options.events <= 0 || options.rate < READS_PER_S || options.width <= 0
+        || options.preempt_ratio < 0 || options.preempt_ratio > 1 || options.max_points < MIN_RETENTION_POINTS) {
+        usage(argv[0]);
+    }
+
+    int events_per_read = options.rate / READS_PER_S;
+    uint64_t step_ns = NS_IN_S / options.rate;
+    char *text = malloc((size_t) events_per_read * LINE_SIZE + PARSE_PADDING);
+    if (text == NULL) ERROR("out of memory.");
+
+    Aggregator aggregator;
+    init_aggregator(&aggregator, false);
+    Graph graph = {.max_points = options.max_points};
+    EntryVec entries = {0};
+    StageStats stages[STAGES_COUNT] = {0};
+    double checksum = 0;
+    int reads = 0;
+    uint64_t total_bytes = 0;
+
+    uint64_t ktime_ns = NS_IN_S;
+    for (long events = 0; events < options.events; events += events_per_read, reads++) {
+        int count = MIN(events_per_read, options.events - events);
+        int length = generate_lines(text, count, &ktime_ns, step_ns, &options);
+        total_bytes += length;
+
+        // Time of day is derived from ktime, as in the ecli loader
+        uint64_t start_ns = get_time_ns();
+        parse_ecli_lines(&entries, text, length);
+        for (int i = 0; i < entries.length; i++) entries.data[i].time_s = entries.data[i].ktime_ns / NS_IN_S % S_IN_DAY;
+        add_stage_time(&stages[STAGE_PARSE], start_ns);
+
+        start_ns = get_time_ns();
+        group_entries(&aggregator, &entries);
+        add_stage_time(&stages[STAGE_GROUP], start_ns);
+
+        start_ns = get_time_ns();
+        sync_graph(&graph, &aggregator.graph);
+        add_stage_time(&stages[STAGE_SYNC], start_ns);
+
+        start_ns = get_time_ns();
+        checksum += project(&graph, options.width);
+        add_stage_time(&stages[STAGE_PROJECT], start_ns);
+
+        start_ns = get_time_ns();
+        checksum += query_stats(&graph);
+        add_stage_time(&stages[STAGE_STATS], start_ns);
+    }
+
+    uint64_t total_ns = 0;
+    for (int i = 0; i < STAGES_COUNT; i++) total_ns += stages[i].total_ns;
+
+    printf("%ld events, %d cgroups, %d events per read, %d reads\n", options.events, options.cgroups,
+           events_per_read, reads);
+    printf("%.0f events/s (%.3fs)\n", options.events / (total_ns / (double) NS_IN_S), total_ns / (double) NS_IN_S);
+    printf("parse: %.0fMB/s\n", total_bytes / 1e6 / (stages[STAGE_PARSE].total_ns / (double) NS_IN_S));
+    printf("%-8s %12s %12s %12s %12s %10s\n", "stage", "total ms", "p50 us", "p99 us", "max us", "events/s");
+    for (int i = 0; i < STAGES_COUNT; i++) {
+        StageStats *stats = &stages[i];
+        DurationVec *durations_ns = &stats->durations_ns;
+        qsort(durations_ns->data, durations_ns->length, sizeof(*durations_ns->data), compare_durations);
+        printf("%-8s %12.1f %12.1f %12.1f %12.1f %10.3g\n", STAGE_NAMES[i], stats->total_ns / 1e6,
+               get_percentile(durations_ns, 0.5) / 1e3, get_percentile(durations_ns, 0.99) / 1e3,
+               get_percentile(durations_ns, 1) / 1e3, options.events / (stats->total_ns / (double) NS_IN_S));
+        VECTOR_FREE(durations_ns);
+    }
+
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == -1) ERROR("unable to get resource usage.");
+    printf("peak RSS: %.1fMB\n", usage.ru_maxrss / 1024.0);
+    printf("checksum: %g\n", checksum);  // keeps projection and stats from being optimized out
+
+    VECTOR_FREE(&entries);
+    free_graph(&graph);
+    free_aggregator(&aggregator);
+    free(text);
+    return EXIT_SUCCESS;
+}
@@ -8,34 +8,111 @@
 
 char LICENSE[] SEC("license") = "Dual BSD/GPL";
 
-#define RATE_LIMIT_NS 500
-
-#define MAX_RUNQ_ENTRIES 16384
 #define MAX_CGROUP_ENTRIES 8192
-#define MAX_EVENT_ENTRIES 131072
+#define MAX_EVENT_ENTRIES 131072  // size of the ring buffer in bytes
+#define MAX_CGROUP_RULES 1024
+#define MAX_CGROUP_DEPTH 16
+#define MAX_PREEMPTION_PAIRS 16384
 
+// Wakeup time of the task, 0 if it isn't waiting in a runqueue.
+// Storage lives in the task, so it isn't limited or shared and is freed when the task exits.
 struct {
-    __uint(type, BPF_MAP_TYPE_HASH);
-    __uint(max_entries, MAX_RUNQ_ENTRIES);
-    __type(key, u32);
+    __uint(type, BPF_MAP_TYPE_TASK_STORAGE);
+    __uint(map_flags, BPF_F_NO_PREALLOC);
+    __type(key, int);
     __type(value, u64);
 } runq_tasks SEC(".maps");
 
+// Adaptive sampling: every event is sent while the ring buffer is below the threshold, above it each cgroup sends
+// at most one event per interval per CPU, growing linearly up to the max when the ring buffer is full.
+// Skipped events and their preemptions are added to the next sent event, so none are lost from the totals.
+#define SAMPLING_FILL_THRESHOLD (MAX_EVENT_ENTRIES / 4)
+#define MAX_SAMPLE_INTERVAL_NS 1000000  // 1ms
+
+struct sampler {
+    u64 last_ts;  // of the last sent event
+    u32 skipped;           // weight of the events skipped since then
+    u32 skipped_preempts;  // how many of them preempted
+};
+
 struct {
     __uint(type, BPF_MAP_TYPE_PERCPU_HASH);
     __uint(max_entries, MAX_CGROUP_ENTRIES);
-    __uint(key_size, sizeof(u64));
-    __uint(value_size, sizeof(u64));
-} cgroup_last_ts SEC(".maps");
+    __type(key, u64);
+    __type(value, struct sampler);
+} cgroup_samplers SEC(".maps");
+
+// Cgroup filter, filled in by userspace. Rules are looked up only on the first
+// wakeup in a cgroup, after that its sampling ratio costs a single lookup.
+const volatile bool has_cgroup_rules = false;
+const volatile u32 default_sample_ratio = 1;
+
+struct {
+    __uint(type, BPF_MAP_TYPE_HASH);
+    __uint(max_entries, MAX_CGROUP_RULES);
+    __type(key, u64);
+    __type(value, struct cgroup_rule);
+} cgroup_rules SEC(".maps");
+
+struct {
+    __uint(type, BPF_MAP_TYPE_LRU_HASH);
+    __uint(max_entries, MAX_CGROUP_ENTRIES);
+    __type(key, u64);
+    __type(value, u32);
+} cgroup_sample_ratios SEC(".maps");
+
+// Aggregation mode, filled in by userspace. Two slots are used so that
+// one can be read and reset while the other one is being updated.
+const volatile bool aggregate = false;
+u32 active_slot = 0;
+
+struct {
+    __uint(type, BPF_MAP_TYPE_PERCPU_HASH);
+    __uint(map_flags, BPF_F_NO_PREALLOC);
+    __uint(max_entries, 2 * MAX_CGROUP_ENTRIES);
+    __type(key, struct cgroup_stats_key);
+    __type(value, struct cgroup_stats);
+} cgroup_stats SEC(".maps");
+
+// Preemptions between cgroups, always counted in the kernel and drained by userspace
+// with the same two slots scheme, independently of the aggregation mode.
+u32 preemptions_slot = 0;
+
+struct {
+    __uint(type, BPF_MAP_TYPE_PERCPU_HASH);
+    __uint(map_flags, BPF_F_NO_PREALLOC);
+    __uint(max_entries, 2 * MAX_PREEMPTION_PAIRS);
+    __type(key, struct preemption_key);
+    __type(value, u64);
+} preemptions SEC(".maps");
+
+struct {
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __uint(max_entries, DROP_REASONS);
+    __type(key, u32);
+    __type(value, u64);
+} drops SEC(".maps");
 
 struct {
     __uint(type, BPF_MAP_TYPE_RINGBUF);
     __uint(max_entries, MAX_EVENT_ENTRIES);
 } events SEC(".maps");
 
+// Wakeup batching, filled in by userspace. Events are submitted without waking up the consumer until
+// the watermark of unconsumed bytes is reached or the deadline has passed since the last wakeup.
+// With watermark 0 the kernel decides, which wakes up the consumer for every event while it keeps up.
+const volatile u64 wakeup_watermark = 0;
+const volatile u64 wakeup_deadline_ns = 0;
+u64 last_wakeup_ns = 0;
+
 void bpf_rcu_read_lock(void) __ksym;
 void bpf_rcu_read_unlock(void) __ksym;
 
+static __always_inline void count_drop(u32 reason) {
+    u64 *count = bpf_map_lookup_elem(&drops, &reason);
+    if (count != NULL) (*count)++;
+}
+
 u64 get_task_cgroup_id(struct task_struct *task) {
     bpf_rcu_read_lock();
     u64 cgroup_id = task->cgroups->dfl_cgrp->kn->id;
@@ -43,13 +120,135 @@ u64 get_task_cgroup_id(struct task_struct *task) {
     return cgroup_id;
 }
 
+static __always_inline u32 get_sample_ratio(struct task_struct *task, u64 cgroup_id) {
+    u32 *cached_ratio = bpf_map_lookup_elem(&cgroup_sample_ratios, &cgroup_id);
+    if (cached_ratio != NULL) return *cached_ratio;
+
+    u32 ratio = default_sample_ratio;
+    bpf_rcu_read_lock();
+    struct kernfs_node *kn = task->cgroups->dfl_cgrp->kn;
+    for (int i = 0; i < MAX_CGROUP_DEPTH && kn != NULL; i++) {
+        u64 id = kn->id;
+        struct cgroup_rule *rule = bpf_map_lookup_elem(&cgroup_rules, &id);
+        if (rule != NULL) {
+            ratio = rule->sample_ratio;
+            break;
+        }
+        kn = kn->parent;
+    }
+    bpf_rcu_read_unlock();
+
+    bpf_map_update_elem(&cgroup_sample_ratios, &cgroup_id, &ratio, BPF_ANY);
+    return ratio;
+}
+
+static __always_inline u32 log2_u64(u64 v) {
+    u32 r, shift;
+    r = (v > 0xFFFFFFFF) << 5;
+    v >>= r;
+    shift = (v > 0xFFFF) << 4;
+    v >>= shift;
+    r |= shift;
+    shift = (v > 0xFF) << 3;
+    v >>= shift;
+    r |= shift;
+    shift = (v > 0xF) << 2;
+    v >>= shift;
+    r |= shift;
+    shift = (v > 0x3) << 1;
+    v >>= shift;
+    r |= shift;
+    r |= (v >> 1);
+    return r;
+}
+
+static __always_inline void aggregate_event(u64 cgroup_id, u64 latency, u32 weight, u32 preempts) {
+    struct cgroup_stats_key key = {
+        .cgroup_id = cgroup_id,
+        .slot = active_slot,
+    };
+
+    struct cgroup_stats *stats = bpf_map_lookup_elem(&cgroup_stats, &key);
+    if (stats == NULL) {
+        struct cgroup_stats zero = {0};
+        bpf_map_update_elem(&cgroup_stats, &key, &zero, BPF_NOEXIST);
+        stats = bpf_map_lookup_elem(&cgroup_stats, &key);
+        if (stats == NULL) {
+            count_drop(DROP_STATS_MAP_FULL);
+            return;
+        }
+    }
+
+    // Per-CPU value, so no atomics are needed
+    u32 bucket = log2_u64(latency);
+    if (bucket >= LATENCY_BUCKETS) bucket = LATENCY_BUCKETS - 1;
+    stats->latency_buckets[bucket] += weight;
+    stats->total_latency += latency * weight;
+    stats->count += weight;
+    stats->preempts += preempts;
+}
+
+static __always_inline u64 get_submit_flags(u64 now) {
+    if (wakeup_watermark == 0) return 0;
+
+    // Another CPU may have taken a later time after this one
+    u64 last = last_wakeup_ns;
+    bool is_overdue = now > last && now - last >= wakeup_deadline_ns;
+    if (!is_overdue && bpf_ringbuf_query(&events, BPF_RB_AVAIL_DATA) < wakeup_watermark) return BPF_RB_NO_WAKEUP;
+
+    // Of the racing CPUs only the one which swaps the time wakes up the consumer
+    if (__sync_val_compare_and_swap(&last_wakeup_ns, last, now) != last) return BPF_RB_NO_WAKEUP;
+    return BPF_RB_FORCE_WAKEUP;
+}
+
+static __always_inline u64 get_sample_interval(void) {
+    u64 fill = bpf_ringbuf_query(&events, BPF_RB_AVAIL_DATA);
+    if (fill <= SAMPLING_FILL_THRESHOLD) return 0;
+    if (fill >= MAX_EVENT_ENTRIES) return MAX_SAMPLE_INTERVAL_NS;
+    return (fill - SAMPLING_FILL_THRESHOLD) * MAX_SAMPLE_INTERVAL_NS / (MAX_EVENT_ENTRIES - SAMPLING_FILL_THRESHOLD);
+}
+
+static __always_inline void count_preemption(struct task_struct *victim, struct task_struct *aggressor) {
+    u64 victim_cgroup_id = get_task_cgroup_id(victim);
+
+    // Only victims are filtered, counting is cheap enough not to be sampled
+    if (has_cgroup_rules && get_sample_ratio(victim, victim_cgroup_id) == 0) return;
+
+    struct preemption_key key = {
+        .victim_cgroup_id = victim_cgroup_id,
+        .aggressor_cgroup_id = get_task_cgroup_id(aggressor),
+        .slot = preemptions_slot,
+    };
+
+    u64 *count = bpf_map_lookup_elem(&preemptions, &key);
+    if (count == NULL) {
+        u64 zero = 0;
+        bpf_map_update_elem(&preemptions, &key, &zero, BPF_NOEXIST);
+        count = bpf_map_lookup_elem(&preemptions, &key);
+        if (count == NULL) {
+            count_drop(DROP_PREEMPTIONS_MAP_FULL);
+            return;
+        }
+    }
+
+    // Per-CPU value, so no atomics are needed
+    (*count)++;
+}
+
 SEC("tp_btf/sched_wakeup")
 int tp_sched_wakeup(u64 *ctx) {
     struct task_struct *task = (struct task_struct *) ctx[0];
-    u32 pid = task->pid;
-    u64 ktime = bpf_ktime_get_ns();
 
-    bpf_map_update_elem(&runq_tasks, &pid, &ktime, BPF_NOEXIST);
+    // Tasks which aren't traced never get a wakeup time, so the switch ignores them too
+    if (has_cgroup_rules) {
+        u32 ratio = get_sample_ratio(task, get_task_cgroup_id(task));
+        if (ratio == 0 || (ratio > 1 && bpf_get_prandom_u32() % ratio != 0)) return 0;
+    }
+
+    // Keeps the first wakeup if the task hasn't run since
+    u64 *task_ts = bpf_task_storage_get(&runq_tasks, task, NULL, BPF_LOCAL_STORAGE_GET_F_CREATE);
+    if (task_ts == NULL) count_drop(DROP_NO_TASK_STORAGE);
+    else if (*task_ts == 0) *task_ts = bpf_ktime_get_ns();
 
     return 0;
 }
@@ -57,33 +256,79 @@ int tp_sched_wakeup(u64 *ctx) {
 SEC("tp_btf/sched_switch")
 int tp_sched_switch(u64 *ctx) {
     u8 did_preempt = ctx[0];
+    struct task_struct *prev = (struct task_struct *) ctx[1];
     struct task_struct *next = (struct task_struct *) ctx[2];
 
-    u32 next_pid = next->pid;
-    if (next_pid == 0) return 0;  // ignore kernel tasks (which have PID 0)
+    if (next->pid == 0) return 0;  // ignore kernel tasks (which have PID 0)
 
-    // Get previous timestamp
-    u64 *task_ts = bpf_map_lookup_elem(&runq_tasks, &next_pid);
-    if (task_ts == NULL) return 0;
+    // Idle task isn't a victim
+    if (did_preempt && prev->pid != 0) count_preemption(prev, next);
+
+    // Get previous timestamp, storage is kept for the next wakeup
+    u64 *task_ts = bpf_task_storage_get(&runq_tasks, next, NULL, 0);
+    if (task_ts == NULL || *task_ts == 0) return 0;
     u64 now = bpf_ktime_get_ns();
     u64 latency = now - *task_ts;
-    bpf_map_delete_elem(&runq_tasks, &next_pid);
+    *task_ts = 0;
 
-    // Rate limit
     u64 cgroup_id = get_task_cgroup_id(next);
-    u64 *group_ts = bpf_map_lookup_elem(&cgroup_last_ts, &cgroup_id);
-    if (group_ts != NULL && now - *group_ts < RATE_LIMIT_NS) return 0;
-    bpf_map_update_elem(&cgroup_last_ts, &cgroup_id, &now, BPF_ANY);
 
-    // Submit event
+    // Wakeups of filtered cgroups are sampled, so the event stands for ratio of them and is extrapolated
+    u32 weight = 1;
+    if (has_cgroup_rules) {
+        u32 ratio = get_sample_ratio(next, cgroup_id);
+        if (ratio > 1) weight = ratio;
+    }
+    u32 preempts = did_preempt ? weight : 0;
+
+    if (aggregate) {
+        aggregate_event(cgroup_id, latency, weight, preempts);
+        return 0;
+    }
+
+    struct sampler *sampler = bpf_map_lookup_elem(&cgroup_samplers, &cgroup_id);
+    if (sampler == NULL) {
+        struct sampler zero = {0};
+        bpf_map_update_elem(&cgroup_samplers, &cgroup_id, &zero, BPF_NOEXIST);
+        sampler = bpf_map_lookup_elem(&cgroup_samplers, &cgroup_id);
+        if (sampler == NULL) count_drop(DROP_SAMPLER_MAP_FULL);
+    }
+
+    // Per-CPU value, so no atomics are needed
+    if (sampler != NULL) {
+        if (now - sampler->last_ts < get_sample_interval()) {
+            sampler->skipped += weight;
+            sampler->skipped_preempts += preempts;
+            count_drop(DROP_SAMPLED);
+            return 0;
+        }
+        weight += sampler->skipped;
+        preempts += sampler->skipped_preempts;
+    }
+
+    // Submit event, if there is no space its weight and preemptions go to the next one
     struct runq_event *event = bpf_ringbuf_reserve(&events, sizeof(*event), 0);
-    if (event == NULL) return 0;
+    if (event == NULL) {
+        if (sampler != NULL) {
+            sampler->skipped = weight;
+            sampler->skipped_preempts = preempts;
+        }
+        count_drop(DROP_RINGBUF_FULL);
+        return 0;
+    }
+    if (sampler != NULL) {
+        sampler->last_ts = now;
+        sampler->skipped = 0;
+        sampler->skipped_preempts = 0;
+    }
 
-    event->did_preempt = did_preempt;
+    event->preempts = preempts;
     event->cgroup_id = cgroup_id;
     event->runq_latency = latency;
     event->ktime = now;
-    bpf_ringbuf_submit(event, 0);
+    event->cpu = bpf_get_smp_processor_id();
+    event->weight = weight;
+    bpf_ringbuf_submit(event, get_submit_flags(now));
 
     return 0;
 }
@@ -3,13 +3,61 @@
 #ifndef LATENCY_H
 #define LATENCY_H
 
+// Shared with userspace which has no vmlinux.h
+#ifdef __bpf__
 #include <vmlinux.h>
+#else
+#include <linux/types.h>
+#endif
 
 struct runq_event {
-    u8 did_preempt;
-    u64 cgroup_id;
-    u64 runq_latency;
-    u64 ktime;
+    __u32 preempts;  // how many of the events it stands for preempted, old ones had a 0/1 flag
+    __u64 cgroup_id;
+    __u64 runq_latency;
+    __u64 ktime;
+    __u32 cpu;     // where the task was switched in
+    __u32 weight;  // number of events it stands for, the rest were sampled out
+};
+
+// Filter rule of a cgroup's subtree, the closest ancestor's rule applies to each cgroup
+struct cgroup_rule {
+    __u32 sample_ratio;  // 1 in sample_ratio wakeups is traced, 0 excludes the subtree
+    __u32 pad;
+};
+
+// Reasons for which the probes lose data, counted per CPU
+enum drop_reason {
+    DROP_RINGBUF_FULL,          // event didn't fit into the ring buffer, it is a part of the next one's weight
+    DROP_SAMPLED,               // event was sampled out, it is a part of the next sent event's weight
+    DROP_NO_TASK_STORAGE,       // wakeup time couldn't be stored
+    DROP_SAMPLER_MAP_FULL,      // cgroup couldn't be sampled, its events are still sent
+    DROP_STATS_MAP_FULL,        // cgroup's stats couldn't be aggregated
+    DROP_PREEMPTIONS_MAP_FULL,  // preemption couldn't be counted
+    DROP_REASONS,
+};
+
+// Latency histogram has log2(ns) buckets, the last one also holds everything above
+#define LATENCY_BUCKETS 32
+
+struct cgroup_stats_key {
+    __u64 cgroup_id;
+    __u32 slot;
+    __u32 pad;
+};
+
+struct cgroup_stats {
+    __u32 latency_buckets[LATENCY_BUCKETS];
+    __u64 total_latency;
+    __u64 count;
+    __u64 preempts;
+};
+
+// Involuntary switches of a victim cgroup's task by an aggressor cgroup's one, the value is their per-CPU count
+struct preemption_key {
+    __u64 victim_cgroup_id;
+    __u64 aggressor_cgroup_id;
+    __u32 slot;
+    __u32 pad;
 };
 
 #endif  // LATENCY_H
@@ -0,0 +1,31 @@
+#include "address.h"
+#include <stdio.h>
+#include <string.h>
+#include "utils.h"
+
+static const char *DEFAULT_HOST = "127.0.0.1";
+
+void split_address(const char *address, char *host, size_t host_size, const char **port) {
+    assert(address != NULL && host != NULL && port != NULL);
+
+    if (address[0] == '[') {
+        const char *end = strchr(address, ']');
+        if (end == NULL || end[1] != ':') ERROR("address \"%s\" must be \"[host]:port\".", address);
+        if ((size_t) (end - address - 1) >= host_size) ERROR("host of \"%s\" is too long.", address);
+        snprintf(host, host_size, "%.*s", (int) (end - address - 1), address + 1);
+        *port = end + 2;
+        return;
+    }
+
+    const char *colon = strchr(address, ':');
+    if (colon == NULL) {
+        snprintf(host, host_size, "%s", DEFAULT_HOST);
+        *port = address;
+        return;
+    }
+    // Otherwise the port couldn't be told apart from the last group of an IPv6 host
+    if (strchr(colon + 1, ':') != NULL) ERROR("IPv6 host of \"%s\" must be in brackets.", address);
+    if ((size_t) (colon - address) >= host_size) ERROR("host of \"%s\" is too long.", address);
+    snprintf(host, host_size, "%.*s", (int) (colon - address), address);
+    *port = colon + 1;
+}
@@ -0,0 +1,10 @@
+#ifndef ADDRESS_H
+#define ADDRESS_H
+
+#include <stddef.h>
+
+// Splits "[host:]port" into the host, localhost if it's omitted, and the port, which points into the address.
+// IPv6 hosts must be in brackets, e.g. "[::1]:9100".
+void split_address(const char *address, char *host, size_t host_size, const char **port);
+
+#endif  // ADDRESS_H
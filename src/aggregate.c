@@ -0,0 +1,687 @@
+#include "aggregate.h"
+#include <string.h>
+
+const Granularity GRANULARITIES[GRANULARITIES_COUNT] = {
+    {.point_ns = 10000000ULL, .retention_ns = 60 * 1000000000ULL, .name = "10ms"},        // for 1m
+    {.point_ns = 100000000ULL, .retention_ns = 10 * 60 * 1000000000ULL, .name = "100ms"},  // for 10m
+    {.point_ns = 1000000000ULL, .retention_ns = 0, .name = "1s"},
+    {.point_ns = 10000000000ULL, .retention_ns = 0, .name = "10s"},
+};
+
+typedef struct {
+    uint64_t age_ns;     // points older than this ...
+    uint64_t bucket_ns;  // ... are merged into buckets of this size
+} RetentionTier;
+
+static const RetentionTier RETENTION_TIERS[] = {
+    {.age_ns = 15 * 60 * 1000000000ULL, .bucket_ns = 60 * 1000000000ULL},       // 1m after 15m
+    {.age_ns = 6 * 3600 * 1000000000ULL, .bucket_ns = 10 * 60 * 1000000000ULL},  // 10m after 6h
+};
+
+// FNV-1a of the first `length` bytes of the name
+static uint64_t hash_name(const char *name, size_t length) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < length; i++) hash = (hash ^ (unsigned char) name[i]) * 1099511628211ULL;
+    return hash;
+}
+
+// Cgroups are indexed by the hash of their name, colliding ones take the following keys.
+// Returns -1 if there is no cgroup with the first `length` bytes of the name, key is then a free one.
+static int find_cgroup_by_name(const Aggregator *aggregator, const char *name, size_t length, uint64_t *key) {
+    *key = hash_name(name, length);
+    int idx;
+    while ((idx = index_map_get(&aggregator->names_index, *key)) != -1) {
+        const char *other = aggregator->graph.cgroups.data[idx].name;
+        if (strncmp(other, name, length) == 0 && other[length] == '\0') return idx;
+        (*key)++;
+    }
+    return -1;
+}
+
+// Parent's name is the name without its last component, e.g. "/a/b/" -> "/a/", returns 0 for the roots
+static size_t get_parent_length(const char *name, size_t length) {
+    if (length > 0 && name[length - 1] == '/') length--;
+    while (length > 0 && name[length - 1] != '/') length--;
+    return length;
+}
+
+static int add_cgroup(Aggregator *aggregator, uint64_t id, const char *name, int parent_idx) {
+    CgroupVec *cgroups = &aggregator->graph.cgroups;
+
+    Cgroup new_cgroup = {
+        .is_enabled = true,
+        .is_systemd = is_systemd_cgroup(name),
+        .id = id,
+        .name = name,
+        .short_name = name + get_parent_length(name, strlen(name)),
+        .parent_idx = parent_idx,
+        .depth = parent_idx == -1 ? 0 : cgroups->data[parent_idx].depth + 1,
+        .entries_count = 0,
+    };
+    if (parent_idx != -1) cgroups->data[parent_idx].has_children = true;
+
+    VECTOR_PUSH(cgroups, new_cgroup);
+    return cgroups->length - 1;
+}
+
+// Creates the missing ancestors first, so parents always precede their children
+static int get_or_create_by_name(Aggregator *aggregator, const char *name, size_t length) {
+    uint64_t key;
+    int idx = find_cgroup_by_name(aggregator, name, length, &key);
+    if (idx != -1) return idx;
+
+    size_t parent_length = get_parent_length(name, length);
+    int parent_idx = parent_length > 0 ? get_or_create_by_name(aggregator, name, parent_length) : -1;
+    // Key may have been taken by an ancestor
+    find_cgroup_by_name(aggregator, name, length, &key);
+
+    // Ancestors get their own copy of the name, and their id if it can be resolved
+    uint64_t id = 0;
+    if (name[length] != '\0') {
+        char *copy = arena_alloc(&aggregator->cgroup_names.names, length + 1);
+        memcpy(copy, name, length);
+        copy[length] = '\0';
+        name = copy;
+
+        if (aggregator->cgroup_names.mount_fd != -1 && find_cgroup_id(name, &id)) {
+            index_map_set(&aggregator->cgroups_index, id, aggregator->graph.cgroups.length);
+        }
+    }
+
+    idx = add_cgroup(aggregator, id, name, parent_idx);
+    index_map_set(&aggregator->names_index, key, idx);
+    return idx;
+}
+
+static Cgroup *get_or_create_cgroup(Aggregator *aggregator, uint64_t id) {
+    CgroupVec *cgroups = &aggregator->graph.cgroups;
+
+    int idx = index_map_get(&aggregator->cgroups_index, id);
+    if (idx != -1) return &cgroups->data[idx];
+
+    // Names of deleted cgroups are unknown, so each one is a root of its own
+    const CgroupInfo *info = get_cgroup_info(&aggregator->cgroup_names, id);
+    if (info->is_deleted) {
+        idx = add_cgroup(aggregator, id, info->name, -1);
+    } else {
+        idx = get_or_create_by_name(aggregator, info->name, strlen(info->name));
+    }
+
+    // Cgroup may have been created as an ancestor, or be recreated at the same path under a new id
+    if (cgroups->data[idx].id == 0) cgroups->data[idx].id = id;
+    index_map_set(&aggregator->cgroups_index, id, idx);
+    return &cgroups->data[idx];
+}
+
+// Series are ended with a zero point once they have no events for longer than a point of their granularity
+static void add_zero_points(Graph *graph) {
+    for (int i = 0; i < graph->cgroups.length; i++) {
+        for (int j = graph->finest_granularity; j < GRANULARITIES_COUNT; j++) {
+            Series *series = &graph->cgroups.data[i].series[j];
+            uint64_t zero_point_ns = GRANULARITIES[j].point_ns;
+
+            Latency *last_latency = VECTOR_LAST(&series->latencies);
+            if (last_latency != NULL && last_latency->count > 0 && last_latency->ktime_ns < graph->max_ktime_ns
+                && graph->max_ktime_ns - last_latency->ktime_ns > zero_point_ns) {
+                graph->max_latency_ns[j]
+                    = MAX(graph->max_latency_ns[j], last_latency->total_latency_ns / last_latency->count);
+
+                Latency latency = {
+                    .ktime_ns = graph->max_ktime_ns,
+                    .total_latency_ns = 0,
+                    .count = 0,
+                };
+                VECTOR_PUSH(&series->latencies, latency);
+                if (j >= FIRST_SKETCH_GRANULARITY) VECTOR_PUSH(&series->sketches, (Sketch) {0});
+            }
+
+            Preempt *last_preempt = VECTOR_LAST(&series->preempts);
+            if (last_preempt != NULL && last_preempt->count > 0 && last_preempt->ktime_ns < graph->max_ktime_ns
+                && graph->max_ktime_ns - last_preempt->ktime_ns > zero_point_ns) {
+                graph->max_preempts[j] = MAX(graph->max_preempts[j], last_preempt->count);
+
+                Preempt preempt = {
+                    .ktime_ns = graph->max_ktime_ns,
+                    .count = 0,
+                    .span = 1,
+                };
+                VECTOR_PUSH(&series->preempts, preempt);
+            }
+        }
+    }
+}
+
+static void update_time_range(Graph *graph, uint32_t first_time_s, uint64_t first_ktime_ns, uint32_t last_time_s) {
+    if (graph->min_ktime_ns == UINT64_MAX) {
+        graph->min_ktime_ns = first_ktime_ns;
+        graph->min_time_s = first_time_s;
+    }
+    graph->max_time_s = last_time_s;
+}
+
+// Same as the histograms in eBPF
+static int get_latency_bucket(uint64_t latency_ns) {
+    if (latency_ns == 0) return 0;
+    return MIN(63 - __builtin_clzll(latency_ns), LATENCY_BUCKETS - 1);
+}
+
+void init_aggregator(Aggregator *aggregator, bool resolve_cgroups) {
+    assert(aggregator != NULL);
+
+    *aggregator = (Aggregator) {
+        .graph = {
+            .min_time_s = UINT32_MAX,
+            .min_ktime_ns = UINT64_MAX,
+        },
+    };
+    init_cgroup_names(&aggregator->cgroup_names, resolve_cgroups);
+}
+
+static Cgroup *get_parent(Graph *graph, const Cgroup *cgroup) {
+    return cgroup->parent_idx == -1 ? NULL : &graph->cgroups.data[cgroup->parent_idx];
+}
+
+static void add_cpu_latency(Graph *graph, Cgroup *cgroup, uint16_t cpu, uint64_t total_latency_ns, uint32_t count) {
+    while (cgroup->cpu_latencies.length <= cpu) VECTOR_PUSH(&cgroup->cpu_latencies, (CpuLatency) {0});
+    cgroup->cpu_latencies.data[cpu].total_latency_ns += total_latency_ns;
+    cgroup->cpu_latencies.data[cpu].count += count;
+    graph->cpus_count = MAX(graph->cpus_count, cpu + 1);
+}
+
+// Adds the entry to the last point of the series if it's within the granularity, otherwise starts a new one.
+// Entry counts as `weight` events with its latency, `preempts` of which preempted.
+static void add_entry(Graph *graph, int granularity, Series *series, Entry entry) {
+    uint64_t point_ns = GRANULARITIES[granularity].point_ns;
+
+    Latency *last_latency = VECTOR_LAST(&series->latencies);
+    if (last_latency != NULL && entry.ktime_ns - last_latency->ktime_ns < point_ns) {
+        last_latency->total_latency_ns += entry.latency_ns * entry.weight;
+        last_latency->count += entry.weight;
+        if (granularity >= FIRST_SKETCH_GRANULARITY) {
+            sketch_add(VECTOR_LAST(&series->sketches), entry.latency_ns, entry.weight);
+        }
+    } else {
+        if (last_latency != NULL && last_latency->count > 0) {
+            graph->max_ktime_ns = MAX(graph->max_ktime_ns, last_latency->ktime_ns);
+            graph->max_latency_ns[granularity]
+                = MAX(graph->max_latency_ns[granularity], last_latency->total_latency_ns / last_latency->count);
+        }
+
+        Latency latency = {
+            .ktime_ns = entry.ktime_ns,
+            .total_latency_ns = entry.latency_ns * entry.weight,
+            .count = entry.weight,
+        };
+        VECTOR_PUSH(&series->latencies, latency);
+        if (granularity >= FIRST_SKETCH_GRANULARITY) {
+            Sketch sketch = {0};
+            sketch_add(&sketch, entry.latency_ns, entry.weight);
+            VECTOR_PUSH(&series->sketches, sketch);
+        }
+    }
+
+    if (entry.preempts == 0) return;
+
+    Preempt *last_preempt = VECTOR_LAST(&series->preempts);
+    if (last_preempt != NULL && entry.ktime_ns - last_preempt->ktime_ns < point_ns) {
+        last_preempt->count += entry.preempts;
+    } else {
+        if (last_preempt != NULL) {
+            graph->max_ktime_ns = MAX(graph->max_ktime_ns, last_preempt->ktime_ns);
+            graph->max_preempts[granularity] = MAX(graph->max_preempts[granularity], last_preempt->count);
+        }
+
+        Preempt preempt = {
+            .ktime_ns = entry.ktime_ns,
+            .count = entry.preempts,
+            .span = 1,
+        };
+        VECTOR_PUSH(&series->preempts, preempt);
+    }
+}
+
+void group_entries(Aggregator *aggregator, EntryVec *entries) {
+    assert(aggregator != NULL && entries != NULL);
+    if (entries->length == 0) return;
+
+    Graph *graph = &aggregator->graph;
+    update_time_range(graph, entries->data[0].time_s, entries->data[0].ktime_ns,
+                      entries->data[entries->length - 1].time_s);
+
+    // All granularities are updated in one pass
+    for (int i = 0; i < entries->length; i++) {
+        Entry entry = entries->data[i];
+
+        Cgroup *cgroup = get_or_create_cgroup(aggregator, entry.cgroup_id);
+        // Series are of the whole subtree, so they are added to all ancestors
+        for (Cgroup *node = cgroup; node != NULL; node = get_parent(graph, node)) {
+            for (int j = 0; j < GRANULARITIES_COUNT; j++) add_entry(graph, j, &node->series[j], entry);
+        }
+        add_cpu_latency(graph, cgroup, entry.cpu, entry.latency_ns * entry.weight, entry.weight);
+
+        cgroup->entries_count += entry.weight;
+        cgroup->entries_latency_ns += entry.latency_ns * entry.weight;
+        cgroup->entries_latency_buckets[get_latency_bucket(entry.latency_ns)] += entry.weight;
+        cgroup->entries_preempts += entry.preempts;
+    }
+    entries->length = 0;
+
+    add_zero_points(graph);
+}
+
+// Bucket i of the kernel histogram holds latencies in [2^i, 2^(i+1)), they are added at the middle
+static void add_latency_buckets(Sketch *sketch, const uint32_t *buckets) {
+    for (int i = 0; i < LATENCY_BUCKETS; i++) {
+        if (buckets[i] > 0) sketch_add(sketch, (1ULL << i) + (1ULL << i) / 2, buckets[i]);
+    }
+}
+
+static void add_batch(Graph *graph, int granularity, Series *series, Batch batch) {
+    uint64_t point_ns = GRANULARITIES[granularity].point_ns;
+
+    // Batches are per CPU and children are rolled up into their parents, so batches from the same window are summed
+    Latency *last_latency = VECTOR_LAST(&series->latencies);
+    if (last_latency != NULL && batch.ktime_ns - last_latency->ktime_ns < point_ns) {
+        last_latency->total_latency_ns += batch.total_latency_ns;
+        last_latency->count += batch.count;
+        if (granularity >= FIRST_SKETCH_GRANULARITY) {
+            add_latency_buckets(VECTOR_LAST(&series->sketches), batch.latency_buckets);
+        }
+    } else {
+        Latency latency = {
+            .ktime_ns = batch.ktime_ns,
+            .total_latency_ns = batch.total_latency_ns,
+            .count = batch.count,
+        };
+        VECTOR_PUSH(&series->latencies, latency);
+        last_latency = VECTOR_LAST(&series->latencies);
+        if (granularity >= FIRST_SKETCH_GRANULARITY) {
+            Sketch sketch = {0};
+            add_latency_buckets(&sketch, batch.latency_buckets);
+            VECTOR_PUSH(&series->sketches, sketch);
+        }
+    }
+    // Count wraps around if a point's batches sum to more than 32 bits
+    if (last_latency->count > 0) {
+        graph->max_latency_ns[granularity]
+            = MAX(graph->max_latency_ns[granularity], last_latency->total_latency_ns / last_latency->count);
+    }
+
+    if (batch.preempts == 0) return;
+
+    Preempt *last_preempt = VECTOR_LAST(&series->preempts);
+    if (last_preempt != NULL && batch.ktime_ns - last_preempt->ktime_ns < point_ns) {
+        last_preempt->count += batch.preempts;
+    } else {
+        Preempt preempt = {
+            .ktime_ns = batch.ktime_ns,
+            .count = batch.preempts,
+            .span = 1,
+        };
+        VECTOR_PUSH(&series->preempts, preempt);
+        last_preempt = VECTOR_LAST(&series->preempts);
+    }
+    graph->max_preempts[granularity] = MAX(graph->max_preempts[granularity], last_preempt->count);
+}
+
+void group_batches(Aggregator *aggregator, BatchVec *batches, uint64_t window_ns) {
+    assert(aggregator != NULL && batches != NULL);
+    if (batches->length == 0) return;
+
+    Graph *graph = &aggregator->graph;
+    update_time_range(graph, batches->data[0].time_s, batches->data[0].ktime_ns,
+                      batches->data[batches->length - 1].time_s);
+
+    // Granularities finer than the window stay empty
+    graph->finest_granularity = 0;
+    while (GRANULARITIES[graph->finest_granularity].point_ns < window_ns) graph->finest_granularity++;
+
+    for (int i = 0; i < batches->length; i++) {
+        Batch batch = batches->data[i];
+
+        Cgroup *cgroup = get_or_create_cgroup(aggregator, batch.cgroup_id);
+        for (Cgroup *node = cgroup; node != NULL; node = get_parent(graph, node)) {
+            for (int j = graph->finest_granularity; j < GRANULARITIES_COUNT; j++) {
+                add_batch(graph, j, &node->series[j], batch);
+            }
+        }
+        if (batch.cpu != UNKNOWN_CPU) add_cpu_latency(graph, cgroup, batch.cpu, batch.total_latency_ns, batch.count);
+        graph->max_ktime_ns = MAX(graph->max_ktime_ns, batch.ktime_ns);
+
+        cgroup->entries_count += batch.count;
+        cgroup->entries_latency_ns += batch.total_latency_ns;
+        for (int j = 0; j < LATENCY_BUCKETS; j++) cgroup->entries_latency_buckets[j] += batch.latency_buckets[j];
+        cgroup->entries_preempts += batch.preempts;
+    }
+    batches->length = 0;
+
+    add_zero_points(graph);
+}
+
+void group_preemptions(Aggregator *aggregator, PreemptionCountVec *preemptions) {
+    assert(aggregator != NULL && preemptions != NULL);
+    if (preemptions->length == 0) return;
+
+    Graph *graph = &aggregator->graph;
+    for (int i = 0; i < preemptions->length; i++) {
+        PreemptionCount preemption = preemptions->data[i];
+
+        // Creating the aggressor may move the victim, so only indices are kept
+        int victim_idx = get_or_create_cgroup(aggregator, preemption.victim_cgroup_id) - graph->cgroups.data;
+        int aggressor_idx = get_or_create_cgroup(aggregator, preemption.aggressor_cgroup_id) - graph->cgroups.data;
+
+        uint64_t key = ((uint64_t) victim_idx << 32) | aggressor_idx;
+        int idx = index_map_get(&aggregator->preemption_pairs_index, key);
+        if (idx == -1) {
+            PreemptionPair pair = {
+                .victim_idx = victim_idx,
+                .aggressor_idx = aggressor_idx,
+                .count = 0,
+            };
+            VECTOR_PUSH(&graph->preemption_pairs, pair);
+            idx = graph->preemption_pairs.length - 1;
+            index_map_set(&aggregator->preemption_pairs_index, key, idx);
+        }
+        graph->preemption_pairs.data[idx].count += preemption.count;
+    }
+    graph->preemption_pairs_version++;
+    preemptions->length = 0;
+}
+
+void free_aggregator(Aggregator *aggregator) {
+    if (aggregator == NULL) return;
+    free_graph(&aggregator->graph);
+    index_map_free(&aggregator->cgroups_index);
+    index_map_free(&aggregator->names_index);
+    index_map_free(&aggregator->preemption_pairs_index);
+    free_cgroup_names(&aggregator->cgroup_names);
+}
+
+LodPoint get_latency_lod_point(const void *latencies, int idx) {
+    Latency latency = ((const LatencyVec *) latencies)->data[idx];
+    uint64_t avg_latency_ns = latency.count > 0 ? latency.total_latency_ns / latency.count : 0;
+    return (LodPoint) {
+        .ktime_ns = latency.ktime_ns,
+        .min = avg_latency_ns,
+        .max = avg_latency_ns,
+        .total = avg_latency_ns,
+        .points = 1,
+    };
+}
+
+LodPoint get_preempt_lod_point(const void *preempts, int idx) {
+    Preempt preempt = ((const PreemptVec *) preempts)->data[idx];
+    // Compacted points are averaged over their span, while the total stays the count
+    return (LodPoint) {
+        .ktime_ns = preempt.ktime_ns,
+        .min = preempt.count / preempt.span,
+        .max = preempt.count / preempt.span,
+        .total = preempt.count,
+        .points = preempt.span,
+    };
+}
+
+static uint64_t get_retention_bucket_ns(uint64_t age_ns) {
+    uint64_t bucket_ns = 0;
+    for (size_t i = 0; i < sizeof(RETENTION_TIERS) / sizeof(*RETENTION_TIERS); i++) {
+        if (age_ns > RETENTION_TIERS[i].age_ns) bucket_ns = RETENTION_TIERS[i].bucket_ns;
+    }
+    return bucket_ns;
+}
+
+// Drops `count` oldest points, the series of the granularity no longer have points before the first remaining one.
+// Count is evaluated once since it may depend on the length.
+#define DROP_POINTS(vec, count, retained_ktime_ns)                                                \
+    do {                                                                                          \
+        int dropped_points = (count);                                                             \
+        (vec)->length -= dropped_points;                                                          \
+        memmove((vec)->data, (vec)->data + dropped_points, (vec)->length * sizeof(*(vec)->data)); \
+        *(retained_ktime_ns) = MAX(*(retained_ktime_ns), (vec)->data[0].ktime_ns);                \
+    } while (0)
+
+// Drops the oldest points if compaction wasn't enough, so that it doesn't run again right away
+#define DROP_OLDEST_POINTS(vec, max_points, retained_ktime_ns)                          \
+    do {                                                                                \
+        if ((vec)->length <= (max_points) * 3 / 4) break;                               \
+        DROP_POINTS((vec), (vec)->length - (max_points) / 2, (retained_ktime_ns));      \
+    } while (0)
+
+// Drops points older than retention_ns once they are over a quarter of the series, so that memmove is amortized.
+// The last point is never expired. Sets `from` to 0 if anything was dropped.
+#define DROP_EXPIRED_POINTS(vec, retention_ns, retained_ktime_ns, from)                             \
+    do {                                                                                            \
+        uint64_t last_ktime_ns = VECTOR_LAST(vec)->ktime_ns;                                        \
+        if ((retention_ns) == 0 || last_ktime_ns < (retention_ns)) break;                           \
+                                                                                                    \
+        uint64_t expiry_ktime_ns = last_ktime_ns - (retention_ns);                                  \
+        int expired = (vec)->length / 4;                                                            \
+        if (expired == 0 || (vec)->data[expired].ktime_ns >= expiry_ktime_ns) break;               \
+        while ((vec)->data[expired].ktime_ns < expiry_ktime_ns) expired++;                          \
+        DROP_POINTS((vec), expired, (retained_ktime_ns));                                           \
+        (from) = 0;                                                                                 \
+    } while (0)
+
+// Sketches are dropped from the front along with the points they are parallel to
+static void drop_sketches(SketchVec *sketches, const LatencyVec *latencies) {
+    if (sketches == NULL || sketches->length <= latencies->length) return;
+
+    int dropped = sketches->length - latencies->length;
+    for (int i = 0; i < dropped; i++) sketch_free(&sketches->data[i]);
+    sketches->length = latencies->length;
+    memmove(sketches->data, sketches->data + dropped, sketches->length * sizeof(*sketches->data));
+}
+
+// Points are sorted by time, so they are merged in place. Sketches are NULL at granularities without them.
+static void compact_latencies(LatencyVec *latencies, SketchVec *sketches, int max_points,
+                              uint64_t *retained_ktime_ns) {
+    uint64_t last_ktime_ns = VECTOR_LAST(latencies)->ktime_ns;
+
+    int length = 0;
+    for (int i = 0; i < latencies->length; i++) {
+        Latency point = latencies->data[i];
+        uint64_t bucket_ns = get_retention_bucket_ns(last_ktime_ns - point.ktime_ns);
+
+        Latency *bucket = length > 0 ? &latencies->data[length - 1] : NULL;
+        if (bucket != NULL && bucket_ns != 0 && bucket->ktime_ns / bucket_ns == point.ktime_ns / bucket_ns) {
+            bucket->total_latency_ns += point.total_latency_ns;
+            bucket->count += point.count;
+            if (sketches != NULL) {
+                sketch_merge(&sketches->data[length - 1], &sketches->data[i]);
+                sketch_free(&sketches->data[i]);
+            }
+        } else {
+            if (sketches != NULL) sketches->data[length] = sketches->data[i];
+            latencies->data[length++] = point;
+        }
+    }
+    latencies->length = length;
+    if (sketches != NULL) sketches->length = length;
+
+    DROP_OLDEST_POINTS(latencies, max_points, retained_ktime_ns);
+    drop_sketches(sketches, latencies);
+}
+
+// Preemptions are summed like the latencies, buckets span their width so that they are drawn as the same rate
+static void compact_preempts(PreemptVec *preempts, uint64_t point_ns, int max_points, uint64_t *retained_ktime_ns) {
+    uint64_t last_ktime_ns = VECTOR_LAST(preempts)->ktime_ns;
+
+    int length = 0;
+    for (int i = 0; i < preempts->length; i++) {
+        Preempt point = preempts->data[i];
+        uint64_t bucket_ns = get_retention_bucket_ns(last_ktime_ns - point.ktime_ns);
+        if (bucket_ns != 0) point.span = MAX(point.span, bucket_ns / point_ns);
+
+        Preempt *bucket = length > 0 ? &preempts->data[length - 1] : NULL;
+        if (bucket != NULL && bucket_ns != 0 && bucket->ktime_ns / bucket_ns == point.ktime_ns / bucket_ns) {
+            bucket->count += point.count;
+            bucket->span = MAX(bucket->span, point.span);
+        } else {
+            preempts->data[length++] = point;
+        }
+    }
+    preempts->length = length;
+
+    DROP_OLDEST_POINTS(preempts, max_points, retained_ktime_ns);
+}
+
+static void sync_series(Graph *dst, int granularity, Series *dst_series, Series *src_series) {
+    uint64_t retention_ns = GRANULARITIES[granularity].retention_ns;
+    uint64_t *retained_ktime_ns = &dst->retained_ktime_ns[granularity];
+
+    // The last synced point may still be accumulating, in which case it is the first one in src
+    LatencyVec *src_latencies = &src_series->latencies;
+    LatencyVec *dst_latencies = &dst_series->latencies;
+    SketchVec *src_sketches = granularity >= FIRST_SKETCH_GRANULARITY ? &src_series->sketches : NULL;
+    SketchVec *dst_sketches = granularity >= FIRST_SKETCH_GRANULARITY ? &dst_series->sketches : NULL;
+    int from = dst_latencies->length;
+    int i = 0;
+    Latency *last_latency = VECTOR_LAST(dst_latencies);
+    if (last_latency != NULL && src_latencies->length > 0
+        && last_latency->ktime_ns == src_latencies->data[0].ktime_ns) {
+        if (last_latency->count != src_latencies->data[0].count) dst_series->latencies_version++;
+        if (dst_sketches != NULL) sketch_copy(VECTOR_LAST(dst_sketches), &src_sketches->data[i]);
+        *last_latency = src_latencies->data[i++];
+        from--;
+    }
+    if (i < src_latencies->length) dst_series->latencies_version++;
+    for (; i < src_latencies->length; i++) {
+        if (dst_latencies->length >= dst->max_points) {
+            compact_latencies(dst_latencies, dst_sketches, dst->max_points, retained_ktime_ns);
+            from = 0;
+        }
+        VECTOR_PUSH(dst_latencies, src_latencies->data[i]);
+        if (dst_sketches != NULL) {
+            VECTOR_PUSH(dst_sketches, (Sketch) {0});
+            sketch_copy(VECTOR_LAST(dst_sketches), &src_sketches->data[i]);
+        }
+    }
+    if (dst_latencies->length > 0) {
+        DROP_EXPIRED_POINTS(dst_latencies, retention_ns, retained_ktime_ns, from);
+        drop_sketches(dst_sketches, dst_latencies);
+    }
+    lod_update(&dst_series->latency_lod, dst_latencies, dst_latencies->length, get_latency_lod_point, from);
+    if (dst_sketches != NULL) lod_update_sketches(&dst_series->latency_lod, dst_sketches, from);
+
+    PreemptVec *src_preempts = &src_series->preempts;
+    PreemptVec *dst_preempts = &dst_series->preempts;
+    from = dst_preempts->length;
+    i = 0;
+    Preempt *last_preempt = VECTOR_LAST(dst_preempts);
+    if (last_preempt != NULL && src_preempts->length > 0
+        && last_preempt->ktime_ns == src_preempts->data[0].ktime_ns) {
+        if (last_preempt->count != src_preempts->data[0].count) dst_series->preempts_version++;
+        *last_preempt = src_preempts->data[i++];
+        from--;
+    }
+    if (i < src_preempts->length) dst_series->preempts_version++;
+    for (; i < src_preempts->length; i++) {
+        if (dst_preempts->length >= dst->max_points) {
+            compact_preempts(dst_preempts, GRANULARITIES[granularity].point_ns, dst->max_points, retained_ktime_ns);
+            from = 0;
+        }
+        VECTOR_PUSH(dst_preempts, src_preempts->data[i]);
+    }
+    if (dst_preempts->length > 0) DROP_EXPIRED_POINTS(dst_preempts, retention_ns, retained_ktime_ns, from);
+    lod_update(&dst_series->preempts_lod, dst_preempts, dst_preempts->length, get_preempt_lod_point, from);
+
+    // Only the last point is needed to continue aggregating
+    if (src_latencies->length > 1) {
+        src_latencies->data[0] = *VECTOR_LAST(src_latencies);
+        src_latencies->length = 1;
+        if (src_sketches != NULL) {
+            Sketch last = *VECTOR_LAST(src_sketches);
+            src_sketches->length--;
+            sketches_truncate(src_sketches, 0);
+            VECTOR_PUSH(src_sketches, last);
+        }
+    }
+    if (src_preempts->length > 1) {
+        src_preempts->data[0] = *VECTOR_LAST(src_preempts);
+        src_preempts->length = 1;
+    }
+}
+
+int get_granularity_for(const Graph *graph, uint64_t start_ktime_ns) {
+    assert(graph != NULL);
+
+    for (int i = graph->finest_granularity; i < GRANULARITIES_COUNT - 1; i++) {
+        if (graph->retained_ktime_ns[i] <= start_ktime_ns) return i;
+    }
+    return GRANULARITIES_COUNT - 1;
+}
+
+void sync_graph(Graph *dst, Graph *src) {
+    assert(dst != NULL && src != NULL && dst->max_points >= MIN_RETENTION_POINTS);
+
+    for (int i = 0; i < src->cgroups.length; i++) {
+        Cgroup *src_cgroup = &src->cgroups.data[i];
+
+        if (i == dst->cgroups.length) {
+            Cgroup new_cgroup = {
+                .is_enabled = true,
+                .is_systemd = src_cgroup->is_systemd,
+                .name = src_cgroup->name,
+                .short_name = src_cgroup->short_name,
+                .parent_idx = src_cgroup->parent_idx,
+                .depth = src_cgroup->depth,
+                .is_expanded = !src_cgroup->is_systemd,
+            };
+            VECTOR_PUSH(&dst->cgroups, new_cgroup);
+        }
+        Cgroup *dst_cgroup = &dst->cgroups.data[i];
+        // Ancestors get their ids and children later
+        dst_cgroup->id = src_cgroup->id;
+        dst_cgroup->has_children = src_cgroup->has_children;
+        dst_cgroup->entries_count = src_cgroup->entries_count;
+        dst_cgroup->entries_latency_ns = src_cgroup->entries_latency_ns;
+        memcpy(dst_cgroup->entries_latency_buckets, src_cgroup->entries_latency_buckets,
+               sizeof(dst_cgroup->entries_latency_buckets));
+        dst_cgroup->entries_preempts = src_cgroup->entries_preempts;
+
+        for (int j = src->finest_granularity; j < GRANULARITIES_COUNT; j++) {
+            sync_series(dst, j, &dst_cgroup->series[j], &src_cgroup->series[j]);
+        }
+
+        // Swapped instead of copied, src is reset to accumulate until the next sync
+        CpuLatencyVec cpu_latencies = dst_cgroup->cpu_latencies;
+        dst_cgroup->cpu_latencies = src_cgroup->cpu_latencies;
+        src_cgroup->cpu_latencies = cpu_latencies;
+        src_cgroup->cpu_latencies.length = 0;
+    }
+
+    dst->min_time_s = src->min_time_s;
+    dst->max_time_s = src->max_time_s;
+    dst->min_ktime_ns = src->min_ktime_ns;
+    dst->max_ktime_ns = src->max_ktime_ns;
+    memcpy(dst->max_latency_ns, src->max_latency_ns, sizeof(dst->max_latency_ns));
+    memcpy(dst->max_preempts, src->max_preempts, sizeof(dst->max_preempts));
+    dst->finest_granularity = src->finest_granularity;
+    dst->cpus_count = src->cpus_count;
+
+    // Pairs are cumulative, so they are copied only when they change
+    if (dst->preemption_pairs_version != src->preemption_pairs_version) {
+        dst->preemption_pairs.length = 0;
+        for (int i = 0; i < src->preemption_pairs.length; i++) {
+            VECTOR_PUSH(&dst->preemption_pairs, src->preemption_pairs.data[i]);
+        }
+        dst->preemption_pairs_version = src->preemption_pairs_version;
+    }
+}
+
+void free_graph(Graph *graph) {
+    if (graph == NULL) return;
+    for (int i = 0; i < graph->cgroups.length; i++) {
+        for (int j = 0; j < GRANULARITIES_COUNT; j++) {
+            Series *series = &graph->cgroups.data[i].series[j];
+            VECTOR_FREE(&series->latencies);
+            sketches_truncate(&series->sketches, 0);
+            VECTOR_FREE(&series->sketches);
+            VECTOR_FREE(&series->preempts);
+            lod_free(&series->latency_lod);
+            lod_free(&series->preempts_lod);
+        }
+        VECTOR_FREE(&graph->cgroups.data[i].cpu_latencies);
+    }
+    VECTOR_FREE(&graph->cgroups);
+    VECTOR_FREE(&graph->preemption_pairs);
+}
@@ -0,0 +1,176 @@
+#ifndef AGGREGATE_H
+#define AGGREGATE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "cgroup_names.h"
+#include "ebpf.h"
+#include "index_map.h"
+#include "lod.h"
+#include "sketch.h"
+#include "utils.h"
+
+// Series are aggregated at all granularities at once, each point covers point_ns from its first event.
+// Fine granularities keep only the recent past, so the graph uses the finest one which still covers the view.
+typedef struct {
+    uint64_t point_ns;
+    uint64_t retention_ns;  // older points are dropped, 0 keeps them subject to compaction
+    const char *name;
+} Granularity;
+
+#define GRANULARITIES_COUNT 4
+
+extern const Granularity GRANULARITIES[GRANULARITIES_COUNT];
+
+// Granularities from this one on keep a sketch per point for quantiles, finer ones only have averages
+#define FIRST_SKETCH_GRANULARITY 2  // 1s
+
+// Kernel aggregates into windows of this size, so only granularities which aren't finer are used with it
+#define KERNEL_BATCHING_TIME_NS 1000000000ULL  // 1s
+
+// Max number of points per series of a synced graph at each granularity, older points are compacted into coarser ones
+// to stay under it
+#define DEFAULT_RETENTION_POINTS 8192
+#define MIN_RETENTION_POINTS 16
+
+typedef struct {
+    uint64_t ktime_ns;
+    uint64_t total_latency_ns;
+    uint32_t count;
+} Latency;
+
+VECTOR_TYPEDEF(LatencyVec, Latency);
+
+typedef struct {
+    uint64_t ktime_ns;
+    uint32_t count;
+    uint32_t span;  // in points of the granularity, more than 1 once compacted, so that it's drawn as a rate
+} Preempt;
+
+VECTOR_TYPEDEF(PreemptVec, Preempt);
+
+// Runqueue latency of a cgroup on one CPU
+typedef struct {
+    uint64_t total_latency_ns;
+    uint32_t count;
+} CpuLatency;
+
+VECTOR_TYPEDEF(CpuLatencyVec, CpuLatency);
+
+// Points of a cgroup at one granularity
+typedef struct {
+    LatencyVec latencies;
+    SketchVec sketches;          // of the latencies' events, parallel to them from FIRST_SKETCH_GRANULARITY on
+    Lod latency_lod;             // only in synced copies
+    uint32_t latencies_version;  // changes with the series, only in synced copies
+
+    PreemptVec preempts;
+    Lod preempts_lod;           // only in synced copies
+    uint32_t preempts_version;  // changes with the series, only in synced copies
+} Series;
+
+// Cgroups form a tree by their paths, series of a cgroup are of its whole subtree while the rest is of its own events
+typedef struct {
+    bool is_enabled;
+    bool is_expanded;  // only in synced copies
+    bool is_pinned;    // shown among the top cgroups regardless of its rank, only in synced copies
+    bool is_visible;   // all ancestors are expanded, updated by the UI
+
+    bool is_systemd;
+    uint64_t id;             // 0 if it's unknown, e.g. an ancestor of a cgroup from another machine
+    const char *name;        // never freed
+    const char *short_name;  // last component of the name
+    int color_idx;  // into the UI's palette, kept while the cgroup is shown, only in synced copies
+
+    int parent_idx;  // -1 for the roots, parents precede their children
+    int depth;
+    bool has_children;
+
+    // Cumulative since the start
+    uint64_t entries_count;
+    uint64_t entries_latency_ns;
+    uint64_t entries_latency_buckets[LATENCY_BUCKETS];  // bucket i holds latencies in [2^i, 2^(i+1)), as in eBPF
+    uint64_t entries_preempts;
+
+    Series series[GRANULARITIES_COUNT];
+    CpuLatencyVec cpu_latencies;  // indexed by CPU, since the previous sync
+
+    uint64_t min_latency_ns;
+    uint64_t max_latency_ns;
+    uint64_t total_latency_ns;
+    uint32_t latency_count;
+    uint64_t p50_latency_ns;
+    uint64_t p99_latency_ns;
+    uint64_t p999_latency_ns;
+    uint32_t min_preempts;
+    uint32_t max_preempts;
+    uint64_t total_preempts;
+    uint32_t preempts_count;
+} Cgroup;
+
+VECTOR_TYPEDEF(CgroupVec, Cgroup);
+
+// Cumulative number of times tasks of the victim cgroup were preempted by tasks of the aggressor one
+typedef struct {
+    int victim_idx;  // both are indices into the graph's cgroups
+    int aggressor_idx;
+    uint64_t count;
+} PreemptionPair;
+
+VECTOR_TYPEDEF(PreemptionPairVec, PreemptionPair);
+
+typedef struct {
+    CgroupVec cgroups;
+    uint32_t min_time_s;
+    uint32_t max_time_s;
+    uint64_t min_ktime_ns;
+    uint64_t max_ktime_ns;
+    // Of each granularity, min latency and preemptions are assumed to be 0
+    uint64_t max_latency_ns[GRANULARITIES_COUNT];
+    uint32_t max_preempts[GRANULARITIES_COUNT];
+    int finest_granularity;  // finer ones are empty
+    int cpus_count;          // highest CPU seen + 1
+    PreemptionPairVec preemption_pairs;
+    uint32_t preemption_pairs_version;  // changes with the pairs
+    // Points before this were dropped from some series of the granularity, only in synced copies
+    uint64_t retained_ktime_ns[GRANULARITIES_COUNT];
+    int max_points;  // only in synced copies
+} Graph;
+
+typedef struct {
+    Graph graph;
+    IndexMap cgroups_index;           // id -> graph.cgroups
+    IndexMap names_index;             // hash of name -> graph.cgroups
+    IndexMap preemption_pairs_index;  // victim_idx << 32 | aggressor_idx -> graph.preemption_pairs
+    CgroupNames cgroup_names;
+} Aggregator;
+
+// Cgroups are resolved on this machine only if resolve_cgroups is set, see init_cgroup_names
+void init_aggregator(Aggregator *aggregator, bool resolve_cgroups);
+
+// All consume the whole vector. Batches are of windows of window_ns, which must not be longer than the coarsest
+// granularity.
+void group_entries(Aggregator *aggregator, EntryVec *entries);
+void group_batches(Aggregator *aggregator, BatchVec *batches, uint64_t window_ns);
+void group_preemptions(Aggregator *aggregator, PreemptionCountVec *preemptions);
+
+void free_aggregator(Aggregator *aggregator);
+
+// LodGetPoint for LatencyVec, the value is average latency
+LodPoint get_latency_lod_point(const void *latencies, int idx);
+
+// LodGetPoint for PreemptVec
+LodPoint get_preempt_lod_point(const void *preempts, int idx);
+
+// Returns the finest granularity whose series have all points from start_ktime_ns on
+int get_granularity_for(const Graph *graph, uint64_t start_ktime_ns);
+
+// Moves points from src to dst, src keeps only the last point of each series which may still be accumulating.
+// Latencies per CPU are moved as a whole, so dst's are only of this sync.
+// Also compacts dst's series, drops the expired ones and updates their level of detail pyramids.
+// Cgroups appended to dst are enabled, expanded unless they are systemd's, and have no color.
+void sync_graph(Graph *dst, Graph *src);
+
+void free_graph(Graph *graph);
+
+#endif  // AGGREGATE_H
@@ -0,0 +1,53 @@
+#include "arena.h"
+#include <stdalign.h>
+#include <string.h>
+#include "utils.h"
+
+#define ARENA_BLOCK_SIZE (64 * 1024)
+
+struct ArenaBlock {
+    ArenaBlock *next;
+    size_t capacity;
+    size_t used;
+    alignas(max_align_t) char data[];
+};
+
+void *arena_alloc(Arena *arena, size_t size) {
+    assert(arena != NULL);
+
+    size = (size + alignof(max_align_t) - 1) & ~(alignof(max_align_t) - 1);
+
+    ArenaBlock *block = arena->head;
+    if (block == NULL || block->capacity - block->used < size) {
+        size_t capacity = MAX(size, (size_t) ARENA_BLOCK_SIZE);
+        block = malloc(sizeof(*block) + capacity);
+        if (block == NULL) ERROR("out of memory.");
+        block->next = arena->head;
+        block->capacity = capacity;
+        block->used = 0;
+        arena->head = block;
+    }
+
+    void *ptr = block->data + block->used;
+    block->used += size;
+    return ptr;
+}
+
+char *arena_strdup(Arena *arena, const char *str) {
+    size_t length = strlen(str) + 1;
+    char *copy = arena_alloc(arena, length);
+    memcpy(copy, str, length);
+    return copy;
+}
+
+void arena_free(Arena *arena) {
+    if (arena == NULL) return;
+
+    ArenaBlock *block = arena->head;
+    while (block != NULL) {
+        ArenaBlock *next = block->next;
+        free(block);
+        block = next;
+    }
+    arena->head = NULL;
+}
@@ -0,0 +1,19 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+typedef struct ArenaBlock ArenaBlock;
+
+// Bump allocator, everything is freed at once
+typedef struct {
+    ArenaBlock *head;
+} Arena;
+
+void *arena_alloc(Arena *arena, size_t size);
+
+char *arena_strdup(Arena *arena, const char *str);
+
+void arena_free(Arena *arena);
+
+#endif  // ARENA_H
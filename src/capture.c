@@ -0,0 +1,278 @@
+#define _DEFAULT_SOURCE
+#include "capture.h"
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "index_map.h"
+
+static const char CAPTURE_MAGIC[8] = {'E', 'B', 'P', 'F', 'G', 'R', 'P', 'H'};
+static const uint32_t CAPTURE_VERSION = 3;
+static const uint32_t MIN_CAPTURE_VERSION = 1;  // whose events have no weight
+static const uint64_t NS_IN_S = 1000000000;
+static const uint64_t NS_IN_MS = 1000000;
+static const int MAX_BLOCK_EVENTS = 1 << 20;
+static const int MAX_REPLAY_ENTRIES = 1 << 16;  // per read, so that the graph keeps updating at max speed
+
+#define ALIGNMENT 8
+#define ALIGN(size) (((size) + ALIGNMENT - 1) & ~((size_t) ALIGNMENT - 1))
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+} CaptureHeader;
+
+enum { BLOCK_CGROUP = 1, BLOCK_EVENTS = 2 };
+
+typedef struct {
+    uint32_t type;
+    uint32_t size;  // of the payload without padding
+} BlockHeader;
+
+// Followed by the name
+typedef struct {
+    uint64_t id;
+    uint8_t is_deleted;
+    uint8_t reserved[7];
+} CgroupRecord;
+
+typedef struct {
+    uint64_t ktime_ns;
+    uint64_t cgroup_id;
+    uint64_t latency_ns;
+    uint32_t time_s;
+    uint8_t did_preempt;  // preempts > 0, all that versions before 3 have
+    uint8_t reserved;
+    uint16_t cpu;  // 0 in captures made before it was recorded
+    // Since version 2
+    uint32_t weight;
+    uint32_t preempts;  // since version 3, before it all events of a preempting record preempted
+} EventRecord;
+
+#define V1_EVENT_RECORD_SIZE offsetof(EventRecord, weight)
+
+static FILE *record_file = NULL;
+static IndexMap recorded_cgroups = {0};
+
+static const uint8_t *replay_data = NULL;
+static size_t replay_size = 0;
+static size_t replay_offset = 0;  // of the next block
+static uint32_t replay_version = 0;
+static size_t replay_event_size = 0;  // records of older versions are shorter
+static const uint8_t *replay_events = NULL;
+static int replay_events_length = 0;
+static int replay_event_idx = 0;
+static double replay_speed = 0;
+static bool has_replay_started = false;
+static uint64_t replay_start_ns = 0;  // when the first event was replayed
+static uint64_t replay_first_ktime_ns = 0;
+static CgroupNames *replay_cgroup_names = NULL;
+static atomic_bool is_replay_stopped = false;  // set by another thread
+
+static void write_capture(const void *data, size_t size) {
+    if (fwrite(data, 1, size, record_file) != size) ERROR("unable to write capture.");
+}
+
+static void record_cgroup(const CgroupInfo *info) {
+    static const uint8_t padding[ALIGNMENT] = {0};
+
+    size_t name_size = strlen(info->name) + 1;
+    BlockHeader block = {
+        .type = BLOCK_CGROUP,
+        .size = sizeof(CgroupRecord) + name_size,
+    };
+    CgroupRecord record = {
+        .id = info->id,
+        .is_deleted = info->is_deleted,
+    };
+
+    write_capture(&block, sizeof(block));
+    write_capture(&record, sizeof(record));
+    write_capture(info->name, name_size);
+    write_capture(padding, ALIGN(block.size) - block.size);
+}
+
+void start_recording(const char *path) {
+    assert(path != NULL);
+
+    record_file = fopen(path, "wb");
+    if (record_file == NULL) ERROR("unable to open \"%s\".", path);
+
+    CaptureHeader header = {.version = CAPTURE_VERSION};
+    memcpy(header.magic, CAPTURE_MAGIC, sizeof(header.magic));
+    write_capture(&header, sizeof(header));
+}
+
+void record_entries(const EntryVec *entries, CgroupNames *cgroup_names) {
+    assert(entries != NULL && cgroup_names != NULL && record_file != NULL);
+    if (entries->length == 0) return;
+
+    for (int i = 0; i < entries->length; i++) {
+        uint64_t id = entries->data[i].cgroup_id;
+        if (index_map_get(&recorded_cgroups, id) != -1) continue;
+
+        record_cgroup(get_cgroup_info(cgroup_names, id));
+        index_map_set(&recorded_cgroups, id, 0);
+    }
+
+    for (int start = 0; start < entries->length; start += MAX_BLOCK_EVENTS) {
+        int length = MIN(entries->length - start, MAX_BLOCK_EVENTS);
+        BlockHeader block = {
+            .type = BLOCK_EVENTS,
+            .size = length * sizeof(EventRecord),
+        };
+        write_capture(&block, sizeof(block));
+
+        for (int i = start; i < start + length; i++) {
+            Entry entry = entries->data[i];
+            EventRecord record = {
+                .ktime_ns = entry.ktime_ns,
+                .cgroup_id = entry.cgroup_id,
+                .latency_ns = entry.latency_ns,
+                .time_s = entry.time_s,
+                .did_preempt = entry.preempts > 0,
+                .cpu = entry.cpu,
+                .weight = entry.weight,
+                .preempts = entry.preempts,
+            };
+            write_capture(&record, sizeof(record));
+        }
+    }
+
+    // A crash loses at most the last read
+    if (fflush(record_file) != 0) ERROR("unable to write capture.");
+}
+
+void stop_recording(void) {
+    if (record_file == NULL) return;
+    if (fclose(record_file) != 0) ERROR("unable to write capture.");
+    record_file = NULL;
+    index_map_free(&recorded_cgroups);
+}
+
+static uint64_t get_time_ns(void) {
+    struct timespec ts;
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1) ERROR("unable to get monotonic time.");
+    return ts.tv_sec * NS_IN_S + ts.tv_nsec;
+}
+
+void start_replay(const char *path, double speed, CgroupNames *cgroup_names) {
+    assert(path != NULL && speed >= 0 && cgroup_names != NULL);
+
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) ERROR("unable to open \"%s\".", path);
+
+    struct stat stats;
+    if (fstat(fd, &stats) == -1) ERROR("unable to stat \"%s\".", path);
+    if ((size_t) stats.st_size < sizeof(CaptureHeader)) ERROR("\"%s\" is not a capture.", path);
+
+    void *data = mmap(NULL, stats.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) ERROR("unable to map \"%s\".", path);
+    close(fd);
+    madvise(data, stats.st_size, MADV_SEQUENTIAL);
+
+    const CaptureHeader *header = data;
+    if (memcmp(header->magic, CAPTURE_MAGIC, sizeof(header->magic)) != 0) ERROR("\"%s\" is not a capture.", path);
+    if (header->version < MIN_CAPTURE_VERSION || header->version > CAPTURE_VERSION) {
+        ERROR("unsupported capture version %u.", header->version);
+    }
+
+    replay_version = header->version;
+    replay_event_size = replay_version >= 2 ? sizeof(EventRecord) : V1_EVENT_RECORD_SIZE;
+    replay_data = data;
+    replay_size = stats.st_size;
+    replay_offset = sizeof(CaptureHeader);
+    replay_speed = speed;
+    replay_cgroup_names = cgroup_names;
+}
+
+// Adds cgroups up to the next events block, returns false at the end of the capture
+static bool next_events_block(void) {
+    while (replay_offset + sizeof(BlockHeader) <= replay_size) {
+        const BlockHeader *block = (const BlockHeader *) (replay_data + replay_offset);
+        size_t payload_offset = replay_offset + sizeof(BlockHeader);
+        if (block->size > replay_size - payload_offset) return false;
+
+        const uint8_t *payload = replay_data + payload_offset;
+        replay_offset = payload_offset + ALIGN(block->size);
+
+        if (block->type == BLOCK_CGROUP) {
+            const CgroupRecord *record = (const CgroupRecord *) payload;
+            const char *name = (const char *) (record + 1);
+            if (block->size <= sizeof(*record) || name[block->size - sizeof(*record) - 1] != '\0') {
+                ERROR("capture is corrupted.");
+            }
+            add_cgroup_info(replay_cgroup_names, record->id, name, record->is_deleted);
+        } else if (block->type == BLOCK_EVENTS) {
+            if (block->size % replay_event_size != 0) ERROR("capture is corrupted.");
+            replay_events = payload;
+            replay_events_length = block->size / replay_event_size;
+            replay_event_idx = 0;
+            return true;
+        }
+    }
+    return false;
+}
+
+int read_replay_entries(EntryVec *entries, int timeout_ms) {
+    assert(entries != NULL && replay_data != NULL);
+    if (is_replay_stopped) return -1;
+
+    uint64_t now = get_time_ns();
+    uint64_t due_ktime_ns = UINT64_MAX;
+    if (replay_speed > 0 && has_replay_started) {
+        due_ktime_ns = replay_first_ktime_ns + (now - replay_start_ns) * replay_speed;
+    }
+
+    for (int i = 0; i < MAX_REPLAY_ENTRIES; i++) {
+        if (replay_event_idx == replay_events_length && !next_events_block()) return -1;
+
+        // Fields of newer versions are past the end of older records
+        const EventRecord *record = (const EventRecord *) (replay_events + replay_event_idx * replay_event_size);
+        if (!has_replay_started) {
+            has_replay_started = true;
+            replay_start_ns = now;
+            replay_first_ktime_ns = record->ktime_ns;
+            if (replay_speed > 0) due_ktime_ns = record->ktime_ns;
+        }
+
+        if (record->ktime_ns > due_ktime_ns) {
+            if (i > 0) break;
+
+            uint64_t sleep_ns = MIN((record->ktime_ns - due_ktime_ns) / replay_speed, timeout_ms * NS_IN_MS);
+            struct timespec ts = {
+                .tv_sec = sleep_ns / NS_IN_S,
+                .tv_nsec = sleep_ns % NS_IN_S,
+            };
+            nanosleep(&ts, NULL);
+            break;
+        }
+
+        Entry entry = {
+            .cpu = record->cpu,
+            .time_s = record->time_s,
+            .ktime_ns = record->ktime_ns,
+            .cgroup_id = record->cgroup_id,
+            .latency_ns = record->latency_ns,
+            .weight = replay_version >= 2 ? record->weight : 1,
+        };
+        entry.preempts = replay_version >= 3 ? record->preempts : (record->did_preempt ? entry.weight : 0);
+        VECTOR_PUSH(entries, entry);
+        replay_event_idx++;
+    }
+
+    return 0;
+}
+
+void stop_replay(void) { is_replay_stopped = true; }
+
+void close_replay(void) {
+    if (replay_data != NULL) munmap((void *) replay_data, replay_size);
+    replay_data = NULL;
+}
@@ -0,0 +1,32 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include "cgroup_names.h"
+#include "ebpf.h"
+
+// Capture file is a header followed by blocks, each one is a type, payload size and payload padded to 8 bytes.
+// Everything is in host byte order and aligned, so the file is mmap-ed and read in place:
+//   CGROUP - id, whether it was deleted and NUL-terminated name, precedes the first event of the cgroup
+//   EVENTS - array of events as they were read from eBPF, ones of version 1 have no weight and of version 2 no
+//            count of preemptions
+// A block cut off by a crash ends the capture, unknown blocks are skipped.
+
+// Appends entries and metadata of their cgroups which haven't been recorded yet
+void start_recording(const char *path);
+void record_entries(const EntryVec *entries, CgroupNames *cgroup_names);
+void stop_recording(void);
+
+// Speed is relative to the capture, 0 is as fast as possible.
+// Cgroups are added to cgroup_names as they are read, so it must outlive the replay.
+void start_replay(const char *path, double speed, CgroupNames *cgroup_names);
+
+// Same as read_entries, appends the entries that are due, waiting up to timeout_ms for them.
+// Returns -1 once the capture has ended or the replay has been stopped.
+int read_replay_entries(EntryVec *entries, int timeout_ms);
+
+// Can be called from any thread
+void stop_replay(void);
+
+void close_replay(void);
+
+#endif  // CAPTURE_H
@@ -0,0 +1,154 @@
+#define _GNU_SOURCE
+#include "cgroup_names.h"
+#include <dirent.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char *CGROUP_MOUNT_PATH = "/sys/fs/cgroup";
+static const int CGROUP_PATH_PREFIX_LENGTH = 14;  // = strlen("/sys/fs/cgroup");
+#define PATH_BUFFER_SIZE 4096
+static const char *SYSTEMD_CGROUP_NAMES[] = {"system.slice", "session.slice", "app.slice", "init.scope"};
+static const char *DELETED_CGROUP_NAME = "(deleted)";
+
+// Handle type of kernfs file handles, its only content is the 64-bit node id which is also the cgroup id
+static const int FILEID_KERNFS = 0xfe;
+
+bool is_systemd_cgroup(const char *name) {
+    const char *ch = name;
+    while (*ch != '\0') {
+        while (*ch == '/') ch++;
+        const char *component = ch;
+        while (*ch != '/' && *ch != '\0') ch++;
+
+        size_t length = ch - component;
+        for (size_t i = 0; i < sizeof(SYSTEMD_CGROUP_NAMES) / sizeof(*SYSTEMD_CGROUP_NAMES); i++) {
+            if (strlen(SYSTEMD_CGROUP_NAMES[i]) == length && strncmp(component, SYSTEMD_CGROUP_NAMES[i], length) == 0) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+const CgroupInfo *add_cgroup_info(CgroupNames *cgroup_names, uint64_t id, const char *name, bool is_deleted) {
+    assert(cgroup_names != NULL && (is_deleted || name != NULL));
+
+    int idx = index_map_get(&cgroup_names->index, id);
+    if (idx != -1) return &cgroup_names->infos.data[idx];
+
+    CgroupInfo info = {
+        .id = id,
+        .name = is_deleted ? DELETED_CGROUP_NAME : arena_strdup(&cgroup_names->names, name),
+        .is_systemd = !is_deleted && is_systemd_cgroup(name),
+        .is_deleted = is_deleted,
+    };
+    VECTOR_PUSH(&cgroup_names->infos, info);
+    index_map_set(&cgroup_names->index, id, cgroup_names->infos.length - 1);
+
+    return VECTOR_LAST(&cgroup_names->infos);
+}
+
+static void collect_cgroup_names_rec(CgroupNames *cgroup_names, char *path) {
+    // Cgroups may be removed while walking, they are skipped
+    struct stat stats;
+    if (stat(path, &stats) == -1) return;
+    add_cgroup_info(cgroup_names, stats.st_ino, path + CGROUP_PATH_PREFIX_LENGTH, false);
+
+    DIR *dir = opendir(path);
+    if (!dir) return;
+
+    size_t path_len = strlen(path);
+
+    struct dirent *dirent;
+    while ((dirent = readdir(dir)) != NULL) {
+        if (strcmp(dirent->d_name, ".") == 0 || strcmp(dirent->d_name, "..") == 0) continue;
+        if (dirent->d_type != DT_DIR) continue;
+
+        size_t dir_len = strlen(dirent->d_name);
+        assert(path_len + dir_len + 1 < PATH_BUFFER_SIZE);
+        memcpy(path + path_len, dirent->d_name, dir_len);
+        path[path_len + dir_len] = '/';
+        path[path_len + dir_len + 1] = '\0';
+
+        collect_cgroup_names_rec(cgroup_names, path);
+    }
+    closedir(dir);
+}
+
+// Returns false if the cgroup doesn't exist anymore
+static bool resolve_cgroup_path(CgroupNames *cgroup_names, uint64_t id, char *path) {
+    union {
+        struct file_handle handle;
+        char bytes[sizeof(struct file_handle) + sizeof(uint64_t)];
+    } handle;
+    handle.handle.handle_bytes = sizeof(uint64_t);
+    handle.handle.handle_type = FILEID_KERNFS;
+    memcpy(handle.handle.f_handle, &id, sizeof(id));
+
+    int fd = open_by_handle_at(cgroup_names->mount_fd, &handle.handle, O_RDONLY | O_DIRECTORY);
+    if (fd == -1) return false;
+
+    char fd_path[64];
+    snprintf(fd_path, sizeof(fd_path), "/proc/self/fd/%d", fd);
+    ssize_t length = readlink(fd_path, path, PATH_BUFFER_SIZE - 2);
+    close(fd);
+    if (length == -1) return false;
+
+    // Same format as the collected names
+    path[length++] = '/';
+    path[length] = '\0';
+
+    // Deleted directory's link has " (deleted)" suffix
+    return strncmp(path, CGROUP_MOUNT_PATH, CGROUP_PATH_PREFIX_LENGTH) == 0 && strstr(path, " (deleted)") == NULL;
+}
+
+void init_cgroup_names(CgroupNames *cgroup_names, bool resolve_cgroups) {
+    assert(cgroup_names != NULL);
+
+    if (!resolve_cgroups) {
+        cgroup_names->mount_fd = -1;
+        return;
+    }
+
+    cgroup_names->mount_fd = open(CGROUP_MOUNT_PATH, O_RDONLY | O_DIRECTORY);
+    if (cgroup_names->mount_fd == -1) ERROR("unable to open \"%s\".", CGROUP_MOUNT_PATH);
+
+    char path[PATH_BUFFER_SIZE] = "/sys/fs/cgroup/";
+    collect_cgroup_names_rec(cgroup_names, path);
+}
+
+const CgroupInfo *get_cgroup_info(CgroupNames *cgroup_names, uint64_t id) {
+    assert(cgroup_names != NULL);
+
+    int idx = index_map_get(&cgroup_names->index, id);
+    if (idx != -1) return &cgroup_names->infos.data[idx];
+
+    char path[PATH_BUFFER_SIZE];
+    if (cgroup_names->mount_fd == -1 || !resolve_cgroup_path(cgroup_names, id, path)) {
+        return add_cgroup_info(cgroup_names, id, NULL, true);
+    }
+    return add_cgroup_info(cgroup_names, id, path + CGROUP_PATH_PREFIX_LENGTH, false);
+}
+
+bool find_cgroup_id(const char *name, uint64_t *id) {
+    assert(name != NULL && id != NULL);
+
+    char path[PATH_BUFFER_SIZE];
+    if (snprintf(path, sizeof(path), "%s/%s", CGROUP_MOUNT_PATH, name) >= PATH_BUFFER_SIZE) return false;
+
+    // Same as the collected ids
+    struct stat stats;
+    if (stat(path, &stats) == -1 || !S_ISDIR(stats.st_mode)) return false;
+    *id = stats.st_ino;
+    return true;
+}
+
+void free_cgroup_names(CgroupNames *cgroup_names) {
+    if (cgroup_names == NULL) return;
+    VECTOR_FREE(&cgroup_names->infos);
+    index_map_free(&cgroup_names->index);
+    arena_free(&cgroup_names->names);
+    if (cgroup_names->mount_fd != -1) close(cgroup_names->mount_fd);
+}
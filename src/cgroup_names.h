@@ -0,0 +1,43 @@
+#ifndef CGROUP_NAMES_H
+#define CGROUP_NAMES_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "arena.h"
+#include "index_map.h"
+#include "utils.h"
+
+typedef struct {
+    uint64_t id;
+    const char *name;  // path relative to the cgroup2 mount
+    bool is_systemd;
+    bool is_deleted;  // removed before it could be resolved, the name is unknown
+} CgroupInfo;
+
+VECTOR_TYPEDEF(CgroupInfoVec, CgroupInfo);
+
+typedef struct {
+    CgroupInfoVec infos;
+    IndexMap index;  // id -> infos
+    Arena names;
+    int mount_fd;  // -1 if cgroups aren't resolved
+} CgroupNames;
+
+// Collects the existing cgroups, the ones created later are resolved by id on the first lookup.
+// Otherwise only the added cgroups are known, e.g. when replaying a capture from another machine.
+void init_cgroup_names(CgroupNames *cgroup_names, bool resolve_cgroups);
+
+// Does nothing if the cgroup is already known
+const CgroupInfo *add_cgroup_info(CgroupNames *cgroup_names, uint64_t id, const char *name, bool is_deleted);
+
+const CgroupInfo *get_cgroup_info(CgroupNames *cgroup_names, uint64_t id);
+
+// Whether any component of the path is one of systemd's slices or scopes
+bool is_systemd_cgroup(const char *name);
+
+// Finds id of the cgroup at the path relative to the cgroup2 mount, returns false if there is none
+bool find_cgroup_id(const char *name, uint64_t *id);
+
+void free_cgroup_names(CgroupNames *cgroup_names);
+
+#endif  // CGROUP_NAMES_H
@@ -0,0 +1,469 @@
+#define _DEFAULT_SOURCE
+#include "ebpf.h"
+#include <errno.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef USE_ECLI
+#include <fcntl.h>
+#include <linux/prctl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+#include "parse.h"
+#else
+#include <bpf/bpf.h>
+#include <bpf/libbpf.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include "latency.skel.h"
+#endif
+
+static const uint64_t NS_IN_S = 1000000000;
+static const uint32_t S_IN_DAY = 86400;
+
+// CLOCK_REALTIME - CLOCK_MONOTONIC, the latter is what bpf_ktime_get_ns uses
+static int64_t realtime_offset_ns;
+static long utc_offset_s;
+
+static uint32_t ktime_to_time_s(uint64_t ktime_ns) {
+    int64_t realtime_s = (int64_t) (ktime_ns + realtime_offset_ns) / (int64_t) NS_IN_S + utc_offset_s;
+    return realtime_s % S_IN_DAY;
+}
+
+static void init_time_offset(void) {
+    struct timespec monotonic, realtime;
+    if (clock_gettime(CLOCK_MONOTONIC, &monotonic) == -1) ERROR("unable to get monotonic time.");
+    if (clock_gettime(CLOCK_REALTIME, &realtime) == -1) ERROR("unable to get real time.");
+    realtime_offset_ns = (int64_t) (realtime.tv_sec - monotonic.tv_sec) * (int64_t) NS_IN_S
+                         + (realtime.tv_nsec - monotonic.tv_nsec);
+
+    struct tm tm;
+    if (localtime_r(&realtime.tv_sec, &tm) == NULL) ERROR("unable to get local time.");
+    utc_offset_s = tm.tm_gmtoff;
+}
+
+#ifdef USE_ECLI
+
+#define READ_BUFFER_SIZE (1 << 20)
+
+static int input_fd;
+static pid_t child;
+
+void start_ebpf(uint64_t aggregation_window_ns, const CgroupFilter *filter, WakeupOptions wakeup) {
+    if (aggregation_window_ns != 0) ERROR("aggregation in the kernel requires the libbpf loader.");
+    if (filter != NULL) ERROR("filtering cgroups requires the libbpf loader.");
+    // Package is ran with the program's defaults, which wake ecli up for every event
+    if (wakeup.watermark != DEFAULT_WAKEUP_WATERMARK || wakeup.deadline_ns != DEFAULT_WAKEUP_DEADLINE_NS) {
+        ERROR("wakeup options require the libbpf loader.");
+    }
+
+    int fds[2];
+    if (pipe(fds) == -1) ERROR("unable to create pipe.");
+    int read_fd = fds[0];
+    int write_fd = fds[1];
+
+    if (prctl(PR_SET_PDEATHSIG, SIGTERM) == -1) ERROR("unable to set PDEATHSIG for eBPF process.");
+
+    pid_t pid = fork();
+    if (pid == -1) ERROR("unable to fork.");
+    child = pid;
+
+    if (pid == 0) {
+        if (dup2(write_fd, fileno(stdout)) == -1) exit(EXIT_FAILURE);
+        if (close(read_fd) != 0) exit(EXIT_FAILURE);
+        execlp("ecli", "ecli", "run", "ebpf/package.json", (char *) NULL);
+        if (errno == ENOENT) exit(ENOENT);
+        exit(EXIT_FAILURE);
+    }
+
+    if (close(write_fd) != 0) ERROR("unable to close pipe's write end.");
+    if (fcntl(read_fd, F_SETFL, fcntl(read_fd, F_GETFL) | O_NONBLOCK) == -1) {
+        ERROR("unable to make pipe's read end non-blocking.");
+    }
+
+    input_fd = read_fd;
+    init_time_offset();
+}
+
+static int read_lines(EntryVec *entries) {
+    assert(entries != NULL);
+
+    // Holds many lines, so that a read is parsed in one go
+    static char buffer[READ_BUFFER_SIZE + PARSE_PADDING];
+    static int buffer_length = 0;
+    static bool skipped_header = false;
+
+    ssize_t bytes;
+    while ((bytes = read(input_fd, buffer + buffer_length, READ_BUFFER_SIZE - buffer_length)) > 0) {
+        buffer_length += bytes;
+
+        int offset = 0;
+        if (!skipped_header) {
+            const char *newline = memchr(buffer, '\n', buffer_length);
+            if (newline == NULL) continue;
+            offset = newline + 1 - buffer;
+            skipped_header = true;
+        }
+
+        int first_entry = entries->length;
+        offset += parse_ecli_lines(entries, buffer + offset, buffer_length - offset);
+        for (int i = first_entry; i < entries->length; i++) {
+            entries->data[i].time_s = ktime_to_time_s(entries->data[i].ktime_ns);
+        }
+
+        buffer_length -= offset;
+        memmove(buffer, buffer + offset, buffer_length);
+        if (buffer_length == READ_BUFFER_SIZE) ERROR("line of eBPF process' output is too long.");
+    }
+    if (bytes == -1 && errno != EAGAIN) ERROR("unable to read from eBPF process.");
+    if (bytes == 0) return -1;
+
+    return 0;
+}
+
+int read_entries(EntryVec *entries, int timeout_ms) {
+    struct pollfd pollfd = {
+        .fd = input_fd,
+        .events = POLLIN,
+    };
+    if (poll(&pollfd, 1, timeout_ms) == -1 && errno != EINTR) ERROR("unable to poll eBPF process.");
+
+    if (read_lines(entries) == 0) return 0;
+
+    int status;
+    waitpid(child, &status, 0);
+    status = WEXITSTATUS(status);
+
+    if (status == ENOENT) ERROR("unable to find \"ecli\" to run eBPF program.");
+    if (status != 0) ERROR("eBPF process exited unexpectedly.");
+    return -1;
+}
+
+int read_batches(BatchVec *batches, int timeout_ms) {
+    (void) batches;
+    (void) timeout_ms;
+    ERROR("aggregation in the kernel requires the libbpf loader.");
+}
+
+void read_preemptions(PreemptionCountVec *preemptions) { (void) preemptions; }
+
+bool read_probe_stats(ProbeStats *stats) {
+    (void) stats;
+    return false;
+}
+
+void stop_ebpf(void) { kill(child, SIGTERM); }
+
+void close_ebpf(void) {
+    kill(child, SIGTERM);
+    close(input_fd);
+}
+
+#else
+
+static const uint64_t NS_IN_MS = 1000000;
+static const uint64_t DEFAULT_PREEMPTIONS_WINDOW_NS = 1000000000;  // when not aggregating
+
+static struct latency_bpf *skel = NULL;
+static struct ring_buffer *ring_buffer = NULL;
+static atomic_bool is_stopped = false;  // set by another thread
+
+static uint64_t window_ns = 0;
+static uint64_t window_start_ns = 0;          // of the active slot
+static uint64_t retired_window_start_ns = 0;  // of the other slot, which is drained at the end of the window
+static int num_cpus = 0;
+static struct cgroup_stats *percpu_stats = NULL;
+
+VECTOR_TYPEDEF(StatsKeyVec, struct cgroup_stats_key);
+static StatsKeyVec stats_keys = {0};
+
+static uint64_t preemptions_window_ns = 0;
+static uint64_t preemptions_window_start_ns = 0;
+static uint64_t *percpu_preemptions = NULL;
+
+// Ring buffer's stats are updated by the ingestion thread and read by another one
+static atomic_uint_fast64_t wakeups = 0;
+static atomic_uint_fast64_t delivered_events = 0;
+static atomic_uint_fast64_t total_delivery_ns = 0;
+static uint64_t read_ktime_ns = 0;  // of the current read, taken at its first event
+static uint64_t read_delivery_ns = 0;
+
+static int bpf_stats_fd = -1;  // BPF stats are enabled while it's open
+static uint64_t *percpu_drops = NULL;
+
+VECTOR_TYPEDEF(PreemptionKeyVec, struct preemption_key);
+static PreemptionKeyVec preemption_keys = {0};
+
+static uint64_t get_ktime_ns(void) {
+    struct timespec ts;
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1) ERROR("unable to get monotonic time.");
+    return ts.tv_sec * NS_IN_S + ts.tv_nsec;
+}
+
+static int libbpf_print(enum libbpf_print_level level, const char *format, va_list args) {
+    if (level != LIBBPF_WARN) return 0;
+    return vfprintf(stderr, format, args);
+}
+
+// Ring buffer's context is fixed at creation, so the destination is set for the duration of a consume
+static EntryVec *target_entries = NULL;
+
+static int handle_event(void *ctx, void *data, size_t size) {
+    (void) ctx;
+    const struct runq_event *event = data;
+    if (size < sizeof(*event)) return 0;
+
+    if (read_ktime_ns == 0) read_ktime_ns = get_ktime_ns();
+    if (read_ktime_ns > event->ktime) read_delivery_ns += read_ktime_ns - event->ktime;
+
+    Entry entry = {
+        .cpu = event->cpu,
+        .weight = event->weight,
+        .preempts = event->preempts,
+        .time_s = ktime_to_time_s(event->ktime),
+        .ktime_ns = event->ktime,
+        .cgroup_id = event->cgroup_id,
+        .latency_ns = event->runq_latency,
+    };
+    VECTOR_PUSH(target_entries, entry);
+
+    return 0;
+}
+
+static void set_cgroup_rules(const CgroupFilter *filter) {
+    int fd = bpf_map__fd(skel->maps.cgroup_rules);
+    for (int i = 0; i < filter->rules.length; i++) {
+        const CgroupRule *rule = &filter->rules.data[i];
+        struct cgroup_rule value = {.sample_ratio = rule->sample_ratio};
+        if (bpf_map_update_elem(fd, &rule->cgroup_id, &value, BPF_ANY) != 0) ERROR("unable to set cgroup filter.");
+    }
+}
+
+void start_ebpf(uint64_t aggregation_window_ns, const CgroupFilter *filter, WakeupOptions wakeup) {
+    init_time_offset();
+    libbpf_set_print(libbpf_print);
+
+    skel = latency_bpf__open();
+    if (skel == NULL) ERROR("unable to open eBPF program.");
+    skel->rodata->aggregate = aggregation_window_ns != 0;
+    if (filter != NULL) {
+        skel->rodata->has_cgroup_rules = true;
+        skel->rodata->default_sample_ratio = filter->default_sample_ratio;
+    }
+    if (wakeup.watermark >= bpf_map__max_entries(skel->maps.events) / 4) {
+        ERROR("wakeup watermark must be below a quarter of the ring buffer (%u bytes).",
+              bpf_map__max_entries(skel->maps.events) / 4);
+    }
+    // Otherwise every event would be overdue
+    if (wakeup.watermark != 0 && wakeup.deadline_ns == 0) ERROR("wakeup deadline must be positive with a watermark.");
+    skel->rodata->wakeup_watermark = wakeup.watermark;
+    skel->rodata->wakeup_deadline_ns = wakeup.deadline_ns;
+    if (latency_bpf__load(skel) != 0) ERROR("unable to load eBPF program.");
+    if (filter != NULL) set_cgroup_rules(filter);
+    if (latency_bpf__attach(skel) != 0) ERROR("unable to attach eBPF program.");
+
+    num_cpus = libbpf_num_possible_cpus();
+    if (num_cpus <= 0) ERROR("unable to get the number of CPUs.");
+    if (aggregation_window_ns != 0) {
+        window_ns = aggregation_window_ns;
+        window_start_ns = get_ktime_ns();
+
+        percpu_stats = malloc(num_cpus * sizeof(*percpu_stats));
+        if (percpu_stats == NULL) ERROR("out of memory.");
+    }
+
+    preemptions_window_ns = aggregation_window_ns != 0 ? aggregation_window_ns : DEFAULT_PREEMPTIONS_WINDOW_NS;
+    preemptions_window_start_ns = get_ktime_ns();
+    percpu_preemptions = malloc(num_cpus * sizeof(*percpu_preemptions));
+    percpu_drops = malloc(num_cpus * sizeof(*percpu_drops));
+    if (percpu_preemptions == NULL || percpu_drops == NULL) ERROR("out of memory.");
+
+    // Not fatal, e.g. older kernels only have the sysctl
+    bpf_stats_fd = bpf_enable_stats(BPF_STATS_RUN_TIME);
+
+    ring_buffer = ring_buffer__new(bpf_map__fd(skel->maps.events), handle_event, NULL, NULL);
+    if (ring_buffer == NULL) ERROR("unable to create ring buffer.");
+}
+
+int read_entries(EntryVec *entries, int timeout_ms) {
+    assert(entries != NULL);
+
+    // Programs are detached before it is set, so after this read the ring buffer is empty
+    bool was_stopped = is_stopped;
+
+    target_entries = entries;
+    int start_length = entries->length;
+    read_ktime_ns = 0;
+    read_delivery_ns = 0;
+
+    // Events below the watermark don't wake up the poll, so they are drained on its timeout
+    int ret = ring_buffer__poll(ring_buffer, was_stopped ? 0 : timeout_ms);
+    if (ret > 0) atomic_fetch_add(&wakeups, 1);
+    if (ret == 0) ret = ring_buffer__consume(ring_buffer);
+    target_entries = NULL;
+    if (ret < 0 && ret != -EINTR) ERROR("unable to read from ring buffer.");
+
+    atomic_fetch_add(&delivered_events, entries->length - start_length);
+    atomic_fetch_add(&total_delivery_ns, read_delivery_ns);
+
+    if (was_stopped) return -1;
+    return 0;
+}
+
+static void drain_stats(BatchVec *batches, uint32_t slot, uint64_t slot_start_ns) {
+    int fd = bpf_map__fd(skel->maps.cgroup_stats);
+
+    // Keys are collected first because deleting while iterating restarts the iteration
+    stats_keys.length = 0;
+    struct cgroup_stats_key key, *prev_key = NULL;
+    while (bpf_map_get_next_key(fd, prev_key, &key) == 0) {
+        if (key.slot == slot) VECTOR_PUSH(&stats_keys, key);
+        prev_key = &key;
+    }
+
+    // Counts are taken and reset atomically
+    for (int i = 0; i < stats_keys.length; i++) {
+        if (bpf_map_lookup_and_delete_elem(fd, &stats_keys.data[i], percpu_stats) != 0) continue;
+
+        // Values are per CPU, so each CPU which ran the cgroup gets its own batch
+        for (int cpu = 0; cpu < num_cpus; cpu++) {
+            struct cgroup_stats *stats = &percpu_stats[cpu];
+            if (stats->count == 0) continue;
+
+            Batch batch = {
+                .time_s = ktime_to_time_s(slot_start_ns),
+                .ktime_ns = slot_start_ns,
+                .cgroup_id = stats_keys.data[i].cgroup_id,
+                .cpu = cpu,
+                .total_latency_ns = stats->total_latency,
+                .count = stats->count,
+                .preempts = stats->preempts,
+            };
+            for (int j = 0; j < LATENCY_BUCKETS; j++) batch.latency_buckets[j] = stats->latency_buckets[j];
+            VECTOR_PUSH(batches, batch);
+        }
+    }
+}
+
+int read_batches(BatchVec *batches, int timeout_ms) {
+    assert(batches != NULL && window_ns != 0);
+
+    bool was_stopped = is_stopped;
+    uint64_t now = get_ktime_ns();
+    if (!was_stopped && now - window_start_ns < window_ns) {
+        uint64_t sleep_ns = MIN(window_start_ns + window_ns - now, timeout_ms * NS_IN_MS);
+        struct timespec ts = {
+            .tv_sec = sleep_ns / NS_IN_S,
+            .tv_nsec = sleep_ns % NS_IN_S,
+        };
+        nanosleep(&ts, NULL);
+
+        now = get_ktime_ns();
+        if (now - window_start_ns < window_ns) return 0;
+    }
+
+    // CPUs which read the slot before a switch may still be updating it, so a slot is drained a window after it was
+    // retired, right before it becomes active again. Batches are one window late.
+    uint32_t slot = skel->bss->active_slot;
+    drain_stats(batches, !slot, retired_window_start_ns);
+    __atomic_store_n(&skel->bss->active_slot, !slot, __ATOMIC_RELEASE);
+    retired_window_start_ns = window_start_ns;
+    window_start_ns = now;
+
+    // Programs are detached before it is set, so the last window is complete
+    if (was_stopped) {
+        drain_stats(batches, slot, retired_window_start_ns);
+        return -1;
+    }
+    return 0;
+}
+
+static void drain_preemptions(PreemptionCountVec *preemptions, uint32_t slot) {
+    int fd = bpf_map__fd(skel->maps.preemptions);
+    preemption_keys.length = 0;
+    struct preemption_key key, *prev_key = NULL;
+    while (bpf_map_get_next_key(fd, prev_key, &key) == 0) {
+        if (key.slot == slot) VECTOR_PUSH(&preemption_keys, key);
+        prev_key = &key;
+    }
+
+    for (int i = 0; i < preemption_keys.length; i++) {
+        if (bpf_map_lookup_and_delete_elem(fd, &preemption_keys.data[i], percpu_preemptions) != 0) continue;
+
+        PreemptionCount preemption = {
+            .victim_cgroup_id = preemption_keys.data[i].victim_cgroup_id,
+            .aggressor_cgroup_id = preemption_keys.data[i].aggressor_cgroup_id,
+        };
+        for (int cpu = 0; cpu < num_cpus; cpu++) preemption.count += percpu_preemptions[cpu];
+        if (preemption.count > 0) VECTOR_PUSH(preemptions, preemption);
+    }
+}
+
+void read_preemptions(PreemptionCountVec *preemptions) {
+    assert(preemptions != NULL);
+
+    // Counters stay in the map after the programs are detached, so the last window is read too
+    bool was_stopped = is_stopped;
+    uint64_t now = get_ktime_ns();
+    if (!was_stopped && now - preemptions_window_start_ns < preemptions_window_ns) return;
+    preemptions_window_start_ns = now;
+
+    // Same as with the stats, the retired slot gets a window for the updates in flight
+    uint32_t slot = skel->bss->preemptions_slot;
+    drain_preemptions(preemptions, !slot);
+    __atomic_store_n(&skel->bss->preemptions_slot, !slot, __ATOMIC_RELEASE);
+    if (was_stopped) drain_preemptions(preemptions, slot);
+}
+
+bool read_probe_stats(ProbeStats *stats) {
+    assert(stats != NULL);
+
+    *stats = (ProbeStats) {0};
+
+    int fd = bpf_map__fd(skel->maps.drops);
+    for (uint32_t reason = 0; reason < DROP_REASONS; reason++) {
+        if (bpf_map_lookup_elem(fd, &reason, percpu_drops) != 0) continue;
+        for (int cpu = 0; cpu < num_cpus; cpu++) stats->drops[reason] += percpu_drops[cpu];
+    }
+
+    const struct bpf_program *programs[PROBE_PROGRAMS] = {skel->progs.tp_sched_wakeup, skel->progs.tp_sched_switch};
+    for (int i = 0; i < PROBE_PROGRAMS; i++) {
+        stats->programs[i].name = bpf_program__name(programs[i]);
+
+        struct bpf_prog_info info;
+        memset(&info, 0, sizeof(info));
+        uint32_t info_length = sizeof(info);
+        if (bpf_obj_get_info_by_fd(bpf_program__fd(programs[i]), &info, &info_length) != 0) continue;
+        stats->programs[i].run_time_ns = info.run_time_ns;
+        stats->programs[i].run_count = info.run_cnt;
+    }
+
+    stats->wakeups = wakeups;
+    stats->delivered_events = delivered_events;
+    stats->total_delivery_ns = total_delivery_ns;
+
+    return true;
+}
+
+void stop_ebpf(void) {
+    if (is_stopped) return;
+    latency_bpf__detach(skel);
+    is_stopped = true;
+}
+
+void close_ebpf(void) {
+    free(percpu_stats);
+    VECTOR_FREE(&stats_keys);
+    free(percpu_preemptions);
+    VECTOR_FREE(&preemption_keys);
+    free(percpu_drops);
+    if (bpf_stats_fd >= 0) close(bpf_stats_fd);
+    ring_buffer__free(ring_buffer);
+    latency_bpf__destroy(skel);
+}
+
+#endif
@@ -0,0 +1,98 @@
+#ifndef EBPF_H
+#define EBPF_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "latency.h"
+#include "probe_stats.h"
+#include "utils.h"
+
+typedef struct {
+    uint16_t cpu;
+    uint32_t time_s;
+    uint64_t ktime_ns;
+    uint64_t cgroup_id;
+    uint64_t latency_ns;
+    uint32_t weight;    // number of events it stands for, at least 1
+    uint32_t preempts;  // how many of them preempted, at most weight
+} Entry;
+
+VECTOR_TYPEDEF(EntryVec, Entry);
+
+// Stats of a cgroup on a CPU aggregated in the kernel over one window
+typedef struct {
+    uint32_t time_s;
+    uint64_t ktime_ns;  // start of the window
+    uint64_t cgroup_id;
+    uint16_t cpu;  // UNKNOWN_CPU if it's of all CPUs, e.g. when streamed from an agent
+    uint64_t total_latency_ns;
+    uint32_t count;
+    uint32_t preempts;
+    uint32_t latency_buckets[LATENCY_BUCKETS];
+} Batch;
+
+VECTOR_TYPEDEF(BatchVec, Batch);
+
+#define UNKNOWN_CPU UINT16_MAX
+
+// Number of times tasks of the victim cgroup were preempted by tasks of the aggressor one, over all CPUs
+typedef struct {
+    uint64_t victim_cgroup_id;
+    uint64_t aggressor_cgroup_id;
+    uint64_t count;
+} PreemptionCount;
+
+VECTOR_TYPEDEF(PreemptionCountVec, PreemptionCount);
+
+// Rule for the subtree of a cgroup, the closest ancestor's rule applies to each cgroup
+typedef struct {
+    uint64_t cgroup_id;
+    uint32_t sample_ratio;  // 1 in sample_ratio wakeups is traced, 0 excludes the subtree
+} CgroupRule;
+
+VECTOR_TYPEDEF(CgroupRuleVec, CgroupRule);
+
+typedef struct {
+    CgroupRuleVec rules;
+    uint32_t default_sample_ratio;  // of cgroups without a rule
+} CgroupFilter;
+
+// Consumer of the events is woken up once watermark bytes are unconsumed or deadline_ns has passed since the last
+// wakeup, otherwise they are drained on read_entries' timeout. Watermark 0 wakes it up for every event while it keeps
+// up. Watermark must be below a quarter of the ring buffer, where sampling starts, and needs a positive deadline.
+typedef struct {
+    uint64_t watermark;
+    uint64_t deadline_ns;
+} WakeupOptions;
+
+#define DEFAULT_WAKEUP_WATERMARK (16 * 1024)
+#define DEFAULT_WAKEUP_DEADLINE_NS 50000000ULL  // 50ms
+
+// When aggregation_window_ns is 0 every event is sent to userspace and has to be read with read_entries,
+// otherwise eBPF aggregates them per cgroup and CPU and read_batches returns the stats once per window.
+// Filter is applied in the kernel before anything else is done for a task, NULL traces every cgroup.
+// ecli supports neither aggregation, filter nor wakeup options other than the defaults.
+void start_ebpf(uint64_t aggregation_window_ns, const CgroupFilter *filter, WakeupOptions wakeup);
+
+// Appends new entries, waiting up to timeout_ms for them.
+// Returns -1 once eBPF has stopped and there is nothing left to read.
+int read_entries(EntryVec *entries, int timeout_ms);
+
+// Appends stats of the last window if it ends within timeout_ms.
+// Returns -1 once eBPF has stopped and there is nothing left to read.
+int read_batches(BatchVec *batches, int timeout_ms);
+
+// Appends preemptions between cgroups counted in the kernel, at most once per window (the aggregation one or 1s).
+// Always returns immediately, counts aren't available through ecli.
+void read_preemptions(PreemptionCountVec *preemptions);
+
+// Returns false if the stats aren't available, which is always the case with ecli. BPF stats are enabled
+// for as long as eBPF runs, if that fails run times are only counted with the kernel.bpf_stats_enabled sysctl.
+bool read_probe_stats(ProbeStats *stats);
+
+// Asks eBPF to stop, the remaining entries can still be read. Can be called from any thread.
+void stop_ebpf(void);
+
+void close_ebpf(void);
+
+#endif  // EBPF_H
@@ -0,0 +1,322 @@
+#define _DEFAULT_SOURCE
+#include "exporter.h"
+#include <errno.h>
+#include <netdb.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include "address.h"
+
+static const double NS_IN_S = 1e9;
+static const int LISTEN_BACKLOG = 16;
+static const int REQUEST_TIMEOUT_S = 1;
+static const int MAX_IOVECS = 1024;           // = IOV_MAX
+static const int FIRST_EXPORTED_BUCKET = 10;  // ~1us, lower latencies are counted by it since buckets are cumulative
+#define REQUEST_BUFFER_SIZE 4096
+#define HEADER_BUFFER_SIZE 256
+
+static const char *LATENCY_HELP
+    = "# HELP runq_latency_seconds Time tasks spent waiting in the runqueue.\n"
+      "# TYPE runq_latency_seconds histogram\n";
+static const char *PREEMPTS_HELP
+    = "# HELP runq_preemptions_total Number of times tasks were preempted.\n"
+      "# TYPE runq_preemptions_total counter\n";
+static const char *DROPS_HELP
+    = "# HELP runq_probe_drops_total Data lost by the eBPF probes.\n"
+      "# TYPE runq_probe_drops_total counter\n";
+static const char *RUN_TIME_HELP
+    = "# HELP runq_probe_run_seconds_total Time spent in the eBPF programs, counted only while BPF stats are enabled.\n"
+      "# TYPE runq_probe_run_seconds_total counter\n";
+static const char *RUNS_HELP
+    = "# HELP runq_probe_runs_total Number of runs of the eBPF programs, counted only while BPF stats are enabled.\n"
+      "# TYPE runq_probe_runs_total counter\n";
+static const char *WAKEUPS_HELP
+    = "# HELP runq_ringbuf_wakeups_total Number of reads of the events' ring buffer woken up by the probes.\n"
+      "# TYPE runq_ringbuf_wakeups_total counter\n";
+static const char *DELIVERY_HELP
+    = "# HELP runq_event_delivery_seconds Time from the events to their reads from the ring buffer.\n"
+      "# TYPE runq_event_delivery_seconds summary\n";
+static const char *NOT_FOUND_RESPONSE = "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+
+VECTOR_TYPEDEF(CharVec, char);
+
+// Text of a cgroup's samples, rendered only when its counters change
+typedef struct {
+    bool is_rendered;
+    uint64_t entries_count;
+    uint64_t entries_preempts;
+    CharVec labels;
+    CharVec latency_text;
+    CharVec preempts_text;
+} CgroupMetrics;
+
+VECTOR_TYPEDEF(CgroupMetricsVec, CgroupMetrics);
+VECTOR_TYPEDEF(IovecVec, struct iovec);
+
+static int listen_fd = -1;
+static CgroupMetricsVec metrics = {0};  // parallel to the graph's cgroups
+static IovecVec iovecs = {0};
+static CharVec probe_text = {0};  // rendered on every request, it's only a few lines
+
+static void reserve(CharVec *text, int length) {
+    if (text->capacity >= text->length + length) return;
+
+    text->capacity = MAX(MAX(text->capacity * 2, text->length + length), INITIAL_VECTOR_CAPACITY);
+    text->data = realloc(text->data, text->capacity);
+    if (text->data == NULL) ERROR("out of memory.");
+}
+
+static void append(CharVec *text, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(NULL, 0, format, args);
+    va_end(args);
+
+    // One more for NUL which isn't a part of the text
+    reserve(text, length + 1);
+
+    va_start(args, format);
+    vsnprintf(text->data + text->length, length + 1, format, args);
+    va_end(args);
+    text->length += length;
+}
+
+static void render_labels(CharVec *labels, const Cgroup *cgroup) {
+    labels->length = 0;
+
+    append(labels, "cgroup=\"");
+    for (const char *ch = cgroup->name; *ch != '\0'; ch++) {
+        if (*ch == '\\') append(labels, "\\\\");
+        else if (*ch == '"') append(labels, "\\\"");
+        else if (*ch == '\n') append(labels, "\\n");
+        else append(labels, "%c", *ch);
+    }
+    append(labels, "\"");
+
+    if (cgroup->id != 0) append(labels, ",id=\"%lu\"", cgroup->id);
+}
+
+static void render_metrics(CgroupMetrics *cgroup_metrics, const Cgroup *cgroup) {
+    cgroup_metrics->is_rendered = true;
+    cgroup_metrics->entries_count = cgroup->entries_count;
+    cgroup_metrics->entries_preempts = cgroup->entries_preempts;
+
+    CharVec *labels = &cgroup_metrics->labels;
+    CharVec *text = &cgroup_metrics->latency_text;
+    text->length = 0;
+
+    // Bucket i holds latencies below 2^(i+1), the last one is unbounded. They are whole nanoseconds, so its inclusive
+    // `le` bound is 2^(i+1) - 1ns.
+    uint64_t count = 0;
+    for (int i = 0; i < LATENCY_BUCKETS - 1; i++) {
+        count += cgroup->entries_latency_buckets[i];
+        if (i < FIRST_EXPORTED_BUCKET) continue;
+
+        append(text, "runq_latency_seconds_bucket{%.*s,le=\"%.9f\"} %lu\n", labels->length, labels->data,
+               ((1ULL << (i + 1)) - 1) / NS_IN_S, count);
+    }
+    append(text, "runq_latency_seconds_bucket{%.*s,le=\"+Inf\"} %lu\n", labels->length, labels->data,
+           cgroup->entries_count);
+    append(text, "runq_latency_seconds_sum{%.*s} %.9f\n", labels->length, labels->data,
+           cgroup->entries_latency_ns / NS_IN_S);
+    append(text, "runq_latency_seconds_count{%.*s} %lu\n", labels->length, labels->data, cgroup->entries_count);
+
+    text = &cgroup_metrics->preempts_text;
+    text->length = 0;
+    append(text, "runq_preemptions_total{%.*s} %lu\n", labels->length, labels->data, cgroup->entries_preempts);
+}
+
+static void update_metrics(const Graph *graph) {
+    while (metrics.length < graph->cgroups.length) VECTOR_PUSH(&metrics, (CgroupMetrics) {0});
+
+    for (int i = 0; i < graph->cgroups.length; i++) {
+        const Cgroup *cgroup = &graph->cgroups.data[i];
+        CgroupMetrics *cgroup_metrics = &metrics.data[i];
+        // Ancestors which only roll up their subtrees have no counters of their own, Prometheus sums them by path
+        if (cgroup->entries_count == 0 && cgroup->has_children) continue;
+        if (cgroup_metrics->is_rendered && cgroup_metrics->entries_count == cgroup->entries_count
+            && cgroup_metrics->entries_preempts == cgroup->entries_preempts) {
+            continue;
+        }
+
+        if (!cgroup_metrics->is_rendered) render_labels(&cgroup_metrics->labels, cgroup);
+        render_metrics(cgroup_metrics, cgroup);
+    }
+}
+
+static void render_probe_stats(const ProbeStats *stats) {
+    CharVec *text = &probe_text;
+    text->length = 0;
+
+    append(text, "%s", DROPS_HELP);
+    for (int i = 0; i < DROP_REASONS; i++) {
+        append(text, "runq_probe_drops_total{reason=\"%s\"} %lu\n", DROP_REASON_NAMES[i], stats->drops[i]);
+    }
+    append(text, "%s", RUN_TIME_HELP);
+    for (int i = 0; i < PROBE_PROGRAMS; i++) {
+        append(text, "runq_probe_run_seconds_total{program=\"%s\"} %.9f\n", stats->programs[i].name,
+               stats->programs[i].run_time_ns / NS_IN_S);
+    }
+    append(text, "%s", RUNS_HELP);
+    for (int i = 0; i < PROBE_PROGRAMS; i++) {
+        append(text, "runq_probe_runs_total{program=\"%s\"} %lu\n", stats->programs[i].name,
+               stats->programs[i].run_count);
+    }
+    append(text, "%srunq_ringbuf_wakeups_total %lu\n", WAKEUPS_HELP, stats->wakeups);
+    append(text, "%srunq_event_delivery_seconds_sum %.9f\nrunq_event_delivery_seconds_count %lu\n", DELIVERY_HELP,
+           stats->total_delivery_ns / NS_IN_S, stats->delivered_events);
+}
+
+static void push_iovec(const void *data, size_t length) {
+    struct iovec iovec = {
+        .iov_base = (void *) data,
+        .iov_len = length,
+    };
+    VECTOR_PUSH(&iovecs, iovec);
+}
+
+// Returns false if the client is gone
+static bool write_iovecs(int fd) {
+    struct iovec *iovec = iovecs.data;
+    int length = iovecs.length;
+    while (length > 0) {
+        ssize_t bytes = writev(fd, iovec, MIN(length, MAX_IOVECS));
+        if (bytes == -1 && errno == EINTR) continue;
+        if (bytes <= 0) return false;
+
+        while (length > 0 && (size_t) bytes >= iovec->iov_len) {
+            bytes -= iovec->iov_len;
+            iovec++;
+            length--;
+        }
+        if (length > 0) {
+            iovec->iov_base = (char *) iovec->iov_base + bytes;
+            iovec->iov_len -= bytes;
+        }
+    }
+    return true;
+}
+
+static void respond_metrics(int fd, const Graph *graph, const ProbeStats *probe_stats) {
+    update_metrics(graph);
+
+    // Samples are grouped by metric, so the cached texts are written without copying them into one buffer
+    iovecs.length = 0;
+    push_iovec(NULL, 0);  // header
+    push_iovec(LATENCY_HELP, strlen(LATENCY_HELP));
+    for (int i = 0; i < metrics.length; i++) {
+        push_iovec(metrics.data[i].latency_text.data, metrics.data[i].latency_text.length);
+    }
+    push_iovec(PREEMPTS_HELP, strlen(PREEMPTS_HELP));
+    for (int i = 0; i < metrics.length; i++) {
+        push_iovec(metrics.data[i].preempts_text.data, metrics.data[i].preempts_text.length);
+    }
+    if (probe_stats != NULL) {
+        render_probe_stats(probe_stats);
+        push_iovec(probe_text.data, probe_text.length);
+    }
+
+    size_t content_length = 0;
+    for (int i = 0; i < iovecs.length; i++) content_length += iovecs.data[i].iov_len;
+
+    char header[HEADER_BUFFER_SIZE];
+    int header_length = snprintf(header, sizeof(header),
+                                 "HTTP/1.1 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+                                 "Content-Length: %zu\r\nConnection: close\r\n\r\n",
+                                 content_length);
+    iovecs.data[0].iov_base = header;
+    iovecs.data[0].iov_len = header_length;
+
+    write_iovecs(fd);
+}
+
+static void handle_connection(int fd, const Graph *graph, const ProbeStats *probe_stats) {
+    struct timeval timeout = {.tv_sec = REQUEST_TIMEOUT_S};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    // Only the request line matters
+    char request[REQUEST_BUFFER_SIZE];
+    size_t length = 0;
+    while (length < sizeof(request) - 1) {
+        ssize_t bytes = read(fd, request + length, sizeof(request) - 1 - length);
+        if (bytes <= 0) break;
+        length += bytes;
+        request[length] = '\0';
+        if (strstr(request, "\r\n") != NULL) break;
+    }
+    request[length] = '\0';
+
+    const char *path = "GET /metrics";
+    size_t path_length = strlen(path);
+    if (strncmp(request, path, path_length) == 0 && (request[path_length] == ' ' || request[path_length] == '?')) {
+        respond_metrics(fd, graph, probe_stats);
+    } else {
+        ssize_t ret = write(fd, NOT_FOUND_RESPONSE, strlen(NOT_FOUND_RESPONSE));
+        (void) ret;
+    }
+}
+
+void start_exporter(const char *address) {
+    assert(address != NULL);
+
+    char host[HEADER_BUFFER_SIZE];
+    const char *port;
+    split_address(address, host, sizeof(host), &port);
+
+    struct addrinfo hints = {
+        .ai_family = AF_UNSPEC,
+        .ai_socktype = SOCK_STREAM,
+        .ai_flags = AI_PASSIVE,
+    };
+    struct addrinfo *info;
+    if (getaddrinfo(host, port, &hints, &info) != 0) ERROR("unable to resolve \"%s\".", address);
+
+    listen_fd = socket(info->ai_family, info->ai_socktype | SOCK_CLOEXEC, info->ai_protocol);
+    if (listen_fd == -1) ERROR("unable to create socket.");
+
+    int reuse = 1;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    if (bind(listen_fd, info->ai_addr, info->ai_addrlen) == -1) ERROR("unable to bind to \"%s\".", address);
+    if (listen(listen_fd, LISTEN_BACKLOG) == -1) ERROR("unable to listen on \"%s\".", address);
+    freeaddrinfo(info);
+
+    // Writes to clients which are gone must not kill the process
+    signal(SIGPIPE, SIG_IGN);
+}
+
+void serve_exporter(const Graph *graph, const ProbeStats *probe_stats, int timeout_ms) {
+    assert(graph != NULL && listen_fd != -1);
+
+    struct pollfd pollfd = {
+        .fd = listen_fd,
+        .events = POLLIN,
+    };
+    int ret = poll(&pollfd, 1, timeout_ms);
+    if (ret == -1 && errno != EINTR) ERROR("unable to poll exporter's socket.");
+    if (ret <= 0) return;
+
+    int fd = accept(listen_fd, NULL, NULL);
+    if (fd == -1) return;
+    handle_connection(fd, graph, probe_stats);
+    close(fd);
+}
+
+void close_exporter(void) {
+    if (listen_fd != -1) close(listen_fd);
+    listen_fd = -1;
+
+    for (int i = 0; i < metrics.length; i++) {
+        VECTOR_FREE(&metrics.data[i].labels);
+        VECTOR_FREE(&metrics.data[i].latency_text);
+        VECTOR_FREE(&metrics.data[i].preempts_text);
+    }
+    VECTOR_FREE(&metrics);
+    VECTOR_FREE(&iovecs);
+    VECTOR_FREE(&probe_text);
+}
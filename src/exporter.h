@@ -0,0 +1,16 @@
+#ifndef EXPORTER_H
+#define EXPORTER_H
+
+#include "aggregate.h"
+
+// Serves cumulative per-cgroup latency histograms and preemption counters on /metrics in Prometheus text format.
+// Address is "[host:]port", localhost by default, with IPv6 hosts in brackets.
+void start_exporter(const char *address);
+
+// Handles a request if one arrives within timeout_ms. Only the counters of the graph's cgroups are used.
+// Probe stats are exported too unless they are NULL.
+void serve_exporter(const Graph *graph, const ProbeStats *probe_stats, int timeout_ms);
+
+void close_exporter(void);
+
+#endif  // EXPORTER_H
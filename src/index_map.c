@@ -0,0 +1,77 @@
+#include "index_map.h"
+#include <stdbool.h>
+#include <stdlib.h>
+#include "utils.h"
+
+#define INITIAL_INDEX_MAP_CAPACITY 64
+
+static uint64_t hash(uint64_t key) {
+    // splitmix64 finalizer, ids are often sequential
+    key ^= key >> 30;
+    key *= 0xbf58476d1ce4e5b9ULL;
+    key ^= key >> 27;
+    key *= 0x94d049bb133111ebULL;
+    key ^= key >> 31;
+    return key;
+}
+
+static int find_slot(const IndexMap *map, uint64_t key) {
+    int mask = map->capacity - 1;
+    int i = hash(key) & mask;
+    while (map->values[i] != -1 && map->keys[i] != key) i = (i + 1) & mask;
+    return i;
+}
+
+static void resize(IndexMap *map, int capacity) {
+    IndexMap new_map = {
+        .capacity = capacity,
+        .length = 0,
+        .keys = malloc(capacity * sizeof(*map->keys)),
+        .values = malloc(capacity * sizeof(*map->values)),
+    };
+    if (new_map.keys == NULL || new_map.values == NULL) ERROR("out of memory.");
+    for (int i = 0; i < capacity; i++) new_map.values[i] = -1;
+
+    for (int i = 0; i < map->capacity; i++) {
+        if (map->values[i] == -1) continue;
+
+        int slot = find_slot(&new_map, map->keys[i]);
+        new_map.keys[slot] = map->keys[i];
+        new_map.values[slot] = map->values[i];
+        new_map.length++;
+    }
+
+    index_map_free(map);
+    *map = new_map;
+}
+
+int index_map_get(const IndexMap *map, uint64_t key) {
+    assert(map != NULL);
+    if (map->length == 0) return -1;
+    return map->values[find_slot(map, key)];
+}
+
+void index_map_set(IndexMap *map, uint64_t key, int value) {
+    assert(map != NULL && value >= 0);
+
+    // Keep load factor below 3/4
+    if (map->capacity == 0) resize(map, INITIAL_INDEX_MAP_CAPACITY);
+    else if ((map->length + 1) * 4 > map->capacity * 3) resize(map, map->capacity * 2);
+
+    int slot = find_slot(map, key);
+    if (map->values[slot] == -1) map->length++;
+    map->keys[slot] = key;
+    map->values[slot] = value;
+}
+
+void index_map_clear(IndexMap *map) {
+    assert(map != NULL);
+    for (int i = 0; i < map->capacity; i++) map->values[i] = -1;
+    map->length = 0;
+}
+
+void index_map_free(IndexMap *map) {
+    if (map == NULL) return;
+    free(map->keys);
+    free(map->values);
+}
@@ -0,0 +1,24 @@
+#ifndef INDEX_MAP_H
+#define INDEX_MAP_H
+
+#include <stdint.h>
+
+// Open addressing hash map from a 64-bit id to a non-negative index (e.g. into a vector)
+typedef struct {
+    int capacity;
+    int length;
+    uint64_t *keys;
+    int *values;  // -1 marks an empty slot
+} IndexMap;
+
+// Returns -1 if there is no such key
+int index_map_get(const IndexMap *map, uint64_t key);
+
+// Inserts or overwrites
+void index_map_set(IndexMap *map, uint64_t key, int value);
+
+void index_map_clear(IndexMap *map);
+
+void index_map_free(IndexMap *map);
+
+#endif  // INDEX_MAP_H
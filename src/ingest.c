@@ -0,0 +1,102 @@
+#include "ingest.h"
+#include <pthread.h>
+#include "capture.h"
+#include "ebpf.h"
+#include "stream.h"
+
+static const int READ_TIMEOUT_MS = 100;
+
+static pthread_t thread;
+static IngestOptions options;
+static bool is_ebpf;
+
+// Guards everything below
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static Aggregator aggregator;
+static bool is_running = true;
+
+static void *ingest(void *arg) {
+    (void) arg;
+
+    EntryVec entries = {0};
+    BatchVec batches = {0};
+    PreemptionCountVec preemptions = {0};
+
+    int ret;
+    do {
+        if (options.replay_path != NULL) ret = read_replay_entries(&entries, READ_TIMEOUT_MS);
+        else if (options.listen_address != NULL) ret = read_stream(&batches, &preemptions, READ_TIMEOUT_MS);
+        else if (options.aggregate_in_kernel) ret = read_batches(&batches, READ_TIMEOUT_MS);
+        else ret = read_entries(&entries, READ_TIMEOUT_MS);
+        if (is_ebpf) read_preemptions(&preemptions);
+        if (entries.length == 0 && batches.length == 0 && preemptions.length == 0 && ret == 0) continue;
+
+        // Cgroup names are only used by this thread, so they don't need the lock
+        if (options.record_path != NULL) record_entries(&entries, &aggregator.cgroup_names);
+
+        pthread_mutex_lock(&mutex);
+        group_entries(&aggregator, &entries);
+        group_batches(&aggregator, &batches, is_ebpf ? KERNEL_BATCHING_TIME_NS : get_stream_window_ns());
+        group_preemptions(&aggregator, &preemptions);
+        if (ret != 0) is_running = false;
+        pthread_mutex_unlock(&mutex);
+    } while (ret == 0);
+
+    VECTOR_FREE(&entries);
+    VECTOR_FREE(&batches);
+    VECTOR_FREE(&preemptions);
+    return NULL;
+}
+
+void start_ingestion(const IngestOptions *ingest_options) {
+    assert(ingest_options != NULL);
+    options = *ingest_options;
+    is_ebpf = options.replay_path == NULL && options.listen_address == NULL;
+
+    // Replayed and streamed cgroups are from other machines, their names are in the data
+    init_aggregator(&aggregator, is_ebpf);
+    if (options.replay_path != NULL) {
+        start_replay(options.replay_path, options.replay_speed, &aggregator.cgroup_names);
+    } else if (options.listen_address != NULL) {
+        start_stream_viewer(options.listen_address, &aggregator.cgroup_names);
+    } else {
+        start_ebpf(options.aggregate_in_kernel ? KERNEL_BATCHING_TIME_NS : 0, options.cgroup_filter, options.wakeup);
+    }
+    if (options.record_path != NULL) start_recording(options.record_path);
+
+    if (pthread_create(&thread, NULL, ingest, NULL) != 0) ERROR("unable to create ingestion thread.");
+}
+
+bool sync_ingestion(Graph *graph) {
+    assert(graph != NULL);
+
+    pthread_mutex_lock(&mutex);
+    sync_graph(graph, &aggregator.graph);
+    bool is_ebpf_running = is_running;
+    pthread_mutex_unlock(&mutex);
+
+    return is_ebpf_running;
+}
+
+bool get_probe_stats(ProbeStats *stats) {
+    assert(stats != NULL);
+    if (!is_ebpf) return false;
+    return read_probe_stats(stats);
+}
+
+void stop_ingestion(void) {
+    if (options.replay_path != NULL) stop_replay();
+    else if (options.listen_address != NULL) stop_stream_viewer();
+    else stop_ebpf();
+}
+
+void close_ingestion(void) {
+    stop_ingestion();
+    pthread_join(thread, NULL);
+
+    if (options.replay_path != NULL) close_replay();
+    else if (options.listen_address != NULL) close_stream_viewer();
+    else close_ebpf();
+    stop_recording();
+    free_aggregator(&aggregator);
+}
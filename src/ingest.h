@@ -0,0 +1,32 @@
+#ifndef INGEST_H
+#define INGEST_H
+
+#include <stdbool.h>
+#include "aggregate.h"
+
+typedef struct {
+    bool aggregate_in_kernel;
+    const char *record_path;            // NULL to not record
+    const char *replay_path;            // NULL to read from eBPF
+    const char *listen_address;         // NULL to read from eBPF, otherwise merges the agents' streams
+    double replay_speed;                // 0 is as fast as possible
+    const CgroupFilter *cgroup_filter;  // NULL to trace every cgroup, only for eBPF
+    WakeupOptions wakeup;               // only for eBPF
+} IngestOptions;
+
+// Starts eBPF, replay of a capture or a viewer of agents' streams, and a thread which reads and aggregates its data
+void start_ingestion(const IngestOptions *options);
+
+// Copies the data aggregated since the last call into graph, returns whether eBPF is still running.
+// Blocks only while the ingestion thread is grouping, never while it is waiting for data.
+bool sync_ingestion(Graph *graph);
+
+// Reads drops and run times of the probes, returns false if they aren't available (e.g. when replaying).
+// Doesn't block the ingestion thread.
+bool get_probe_stats(ProbeStats *stats);
+
+void stop_ingestion(void);
+
+void close_ingestion(void);
+
+#endif  // INGEST_H
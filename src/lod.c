@@ -0,0 +1,135 @@
+#include "lod.h"
+#include <math.h>
+
+static void merge_point(LodPoint *dst, LodPoint src) {
+    dst->min = MIN(dst->min, src.min);
+    dst->max = MAX(dst->max, src.max);
+    dst->total += src.total;
+    dst->points += src.points;
+}
+
+// Rebuilds buckets of dst which contain points of src starting from `from`
+static void update_level(LodPointVec *dst, const void *src, int src_length, LodGetPoint get_point, int from) {
+    dst->length = MIN(dst->length, from / 2);
+    for (int i = dst->length * 2; i < src_length; i += 2) {
+        LodPoint point = get_point(src, i);
+        if (i + 1 < src_length) merge_point(&point, get_point(src, i + 1));
+        VECTOR_PUSH(dst, point);
+    }
+}
+
+LodPoint get_lod_level_point(const void *level, int idx) { return ((const LodPointVec *) level)->data[idx]; }
+
+void lod_update(Lod *lod, const void *series, int length, LodGetPoint get_point, int from) {
+    assert(lod != NULL && get_point != NULL);
+
+    if (length < 2) {
+        lod->count = 0;
+        return;
+    }
+    update_level(&lod->levels[0], series, length, get_point, from);
+
+    int level = 1;
+    for (; level < LOD_LEVELS && lod->levels[level - 1].length >= 2; level++) {
+        from /= 2;
+        const LodPointVec *src = &lod->levels[level - 1];
+        update_level(&lod->levels[level], src, src->length, get_lod_level_point, from);
+    }
+    lod->count = level;
+}
+
+// Rebuilt sketches reuse the bins of the previous ones
+static void update_sketch_level(SketchVec *dst, const SketchVec *src, int from) {
+    int length = (src->length + 1) / 2;
+    for (int i = MIN(dst->length, from / 2); i < length; i++) {
+        if (i == dst->length) VECTOR_PUSH(dst, (Sketch) {0});
+        sketch_copy(&dst->data[i], &src->data[2 * i]);
+        if (2 * i + 1 < src->length) sketch_merge(&dst->data[i], &src->data[2 * i + 1]);
+    }
+    sketches_truncate(dst, length);
+}
+
+void lod_update_sketches(Lod *lod, const SketchVec *sketches, int from) {
+    assert(lod != NULL && sketches != NULL);
+
+    const SketchVec *src = sketches;
+    for (int level = 0; level < lod->count; level++) {
+        update_sketch_level(&lod->sketch_levels[level], src, from);
+        src = &lod->sketch_levels[level];
+        from /= 2;
+    }
+}
+
+int lod_level_for(const Lod *lod, double points_per_px) {
+    assert(lod != NULL);
+    if (points_per_px < 2) return -1;
+
+    int level = (int) log2(points_per_px) - 1;
+    return MIN(level, lod->count - 1);
+}
+
+LodPoint lod_query(const Lod *lod, const void *series, LodGetPoint get_point, int from, int to) {
+    assert(lod != NULL && get_point != NULL && 0 <= from && from <= to);
+
+    LodPoint result = {.min = UINT64_MAX};
+    for (int level = -1; from < to; level++) {
+        const void *points = series;
+        LodGetPoint get = get_point;
+        if (level != -1) {
+            points = &lod->levels[level];
+            get = get_lod_level_point;
+        }
+
+        if (level + 1 >= lod->count) {
+            for (int i = from; i < to; i++) merge_point(&result, get(points, i));
+            break;
+        }
+
+        // Boundary points which don't make a whole point of the next level
+        if (from % 2 == 1) merge_point(&result, get(points, from++));
+        if (to % 2 == 1) merge_point(&result, get(points, --to));
+        from /= 2;
+        to /= 2;
+    }
+    return result;
+}
+
+Sketch lod_query_sketch(const Lod *lod, const SketchVec *sketches, int from, int to) {
+    assert(lod != NULL && sketches != NULL && 0 <= from && from <= to);
+
+    Sketch result = {0};
+    for (int level = -1; from < to; level++) {
+        const SketchVec *points = level == -1 ? sketches : &lod->sketch_levels[level];
+
+        if (level + 1 >= lod->count) {
+            for (int i = from; i < to; i++) sketch_merge(&result, &points->data[i]);
+            break;
+        }
+
+        if (from % 2 == 1) sketch_merge(&result, &points->data[from++]);
+        if (to % 2 == 1) sketch_merge(&result, &points->data[--to]);
+        from /= 2;
+        to /= 2;
+    }
+    return result;
+}
+
+int lod_find(const void *series, int length, LodGetPoint get_point, uint64_t ktime_ns) {
+    int lo = 0;
+    int hi = length;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (get_point(series, mid).ktime_ns < ktime_ns) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+void lod_free(Lod *lod) {
+    if (lod == NULL) return;
+    for (int i = 0; i < LOD_LEVELS; i++) {
+        VECTOR_FREE(&lod->levels[i]);
+        sketches_truncate(&lod->sketch_levels[i], 0);
+        VECTOR_FREE(&lod->sketch_levels[i]);
+    }
+}
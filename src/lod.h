@@ -0,0 +1,53 @@
+#ifndef LOD_H
+#define LOD_H
+
+#include <stdint.h>
+#include "sketch.h"
+#include "utils.h"
+
+// Summary of consecutive points of a series
+typedef struct {
+    uint64_t ktime_ns;  // of the first point
+    uint64_t min;
+    uint64_t max;
+    uint64_t total;
+    uint32_t points;
+} LodPoint;
+
+VECTOR_TYPEDEF(LodPointVec, LodPoint);
+
+#define LOD_LEVELS 24
+
+// Pyramid of downsampled series, level i merges 2^(i+1) points of the full resolution series
+typedef struct {
+    int count;
+    LodPointVec levels[LOD_LEVELS];
+    SketchVec sketch_levels[LOD_LEVELS];  // same shape, only for series with a sketch per point
+} Lod;
+
+typedef LodPoint (*LodGetPoint)(const void *series, int idx);
+
+// LodGetPoint for a level
+LodPoint get_lod_level_point(const void *level, int idx);
+
+// Points of the full resolution series starting from `from` were changed or appended
+void lod_update(Lod *lod, const void *series, int length, LodGetPoint get_point, int from);
+
+// Returns the coarsest level with at most `points_per_px` full resolution points per point, -1 is full resolution
+int lod_level_for(const Lod *lod, double points_per_px);
+
+// Summary of points [from, to) of the full resolution series, its ktime_ns is meaningless.
+// Pyramid is used as a segment tree, so it merges O(log n) points.
+LodPoint lod_query(const Lod *lod, const void *series, LodGetPoint get_point, int from, int to);
+
+// Same as lod_update and lod_query for the sketches of the points, which are parallel to the series.
+// lod_update must be called first, and the queried sketch must be freed.
+void lod_update_sketches(Lod *lod, const SketchVec *sketches, int from);
+Sketch lod_query_sketch(const Lod *lod, const SketchVec *sketches, int from, int to);
+
+// Returns the index of the first point at or after ktime_ns
+int lod_find(const void *series, int length, LodGetPoint get_point, uint64_t ktime_ns);
+
+void lod_free(Lod *lod);
+
+#endif  // LOD_H
@@ -1,22 +1,23 @@
 #define _DEFAULT_SOURCE
 #include <assert.h>
-#include <dirent.h>
-#include <errno.h>
-#include <fcntl.h>
-#include <linux/prctl.h>
+#include <getopt.h>
 #include <math.h>
 #include <raylib.h>
+#include <rlgl.h>
 #include <signal.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/prctl.h>
-#include <sys/stat.h>
-#include <sys/wait.h>
 #include <time.h>
 #include <unistd.h>
+#include "aggregate.h"
+#include "cgroup_names.h"
+#include "exporter.h"
+#include "ingest.h"
+#include "stream.h"
+#include "utils.h"
 
 // Window
 static const char *TITLE = "eBPF Graph";
@@ -30,10 +31,21 @@ static const int HOR_PADDING = 60;
 static const int TOP_PADDING = 75;
 static const float BOT_PADDING_PERCENT = 0.34f;  // The rest is graph
 static const int GRID_SIZE = 100;
+static const int LINE_BATCH_VERTICES = 4096;  // fits into rlgl's default batch
+static const float ENVELOPE_ALPHA = 0.35f;    // of the min to max range of aggregated points
+
+// Latency lines, negative quantile is average
+typedef struct {
+    const char *name;
+    double quantile;
+} LatencyLine;
+static const LatencyLine LATENCY_LINES[] = {{"avg", -1}, {"p50", 0.5}, {"p99", 0.99}, {"p99.9", 0.999}};
+#define LATENCY_LINES_LEN (sizeof(LATENCY_LINES) / sizeof(*LATENCY_LINES))
 
 // Units
 static const int NS_IN_US = 1000;
 static const int NS_IN_MS = 1000000;
+static const int NS_IN_S = 1000000000;
 static const int KTIME_SCALING = 1000000;  // ns -> ms
 
 // Axes
@@ -53,6 +65,26 @@ static const int LEGEND_PADDING = 20;
 static const int STATS_LABEL_FONT_SIZE = 20;
 static const int STATS_DATA_FONT_SIZE = 18;
 static const int STATS_COLUMN_PADDING = 20;
+static const int STATS_INDENT_WIDTH = 16;          // per level of the cgroup tree, the first one has the expand marker
+static const int STATS_SCROLL_SPEED = 3;           // rows per wheel step
+static const double PROBE_STATS_INTERVAL_S = 1.0;  // of the probes' rates next to fps
+#define STATS_CELL_SIZE 32
+
+// Heatmap
+static const int HEATMAP_COLUMNS = 600;            // of the ring, one per sync which brought data
+static const double HEATMAP_MIN_LATENCY_NS = 1e3;  // 1us, colors are on a log scale between these
+static const double HEATMAP_MAX_LATENCY_NS = 1e8;  // 100ms
+
+// Preemptions
+#define PREEMPTIONS_MATRIX_SIZE 16  // most involved cgroups
+static const int PREEMPTIONS_MAX_CELL_SIZE = 24;
+static const int PREEMPTIONS_COUNT_WIDTH = 120;
+
+// Top cgroups
+typedef enum { RANK_NONE, RANK_AVG_LATENCY, RANK_P99_LATENCY, RANK_PREEMPTS, RANK_METRICS_COUNT } RankMetric;
+static const char *RANK_METRIC_NAMES[RANK_METRICS_COUNT] = {NULL, "avg latency", "p99 latency", "preemptions"};
+#define DEFAULT_TOP_CGROUPS 10
+static const double RANK_INTERVAL_S = 0.25;  // between rankings unless their inputs change
 
 // Colors
 static const Color BACKGROUND = {0x18, 0x18, 0x18, 0xff};
@@ -64,21 +96,13 @@ static const Color COLORS[]
        {0x60, 0x60, 0xD8, 0xff}, {0x60, 0xD8, 0xD8, 0xff}, {0xD8, 0x60, 0xD8, 0xff}, {0xD8, 0xD8, 0x60, 0xff}};
 #define COLORS_LEN (sizeof(COLORS) / sizeof(*COLORS))
 
-// Data processing
-static const uint64_t CGROUP_BATCHING_TIME_NS = 1000000000;    // 1s
-static const uint64_t CGROUP_ZERO_POINT_TIME_NS = 1000000000;  // 1s
-
 // Controls
 static const float OFFSET_SPEED = 20.0f;
 static const float X_SCALE_SPEED = 1.07f;
 static const float Y_SCALE_SPEED = 1.07f;
 static const float MIN_Y_SCALE = 0.75f;
 static const int MIN_NUMBER_OF_POINTS_VISIBLE = 4;
-
-// Cgroup path
-static const int CGROUP_PATH_PREFIX_LENGTH = 14;  // = strlen("/sys/fs/cgroup");
-#define PATH_BUFFER_SIZE 4096
-static const char *SYSTEMD_CGROUP_NAMES[] = {"system.slice", "session.slice", "app.slice", "init.scope"};
+static const double VIEW_END_EPSILON = 1e-6;  // of the offset, for the view to count as following the end
 
 // Global buffer for temp snprintf-ing
 #define BUFFER_SIZE 256
@@ -103,14 +127,24 @@ static double preempts_per_px = 0;
 static bool draw_latency = true;
 static bool draw_preempts = true;
 static bool bar_graph = true;
-
-#define ERROR(...)                    \
-    do {                              \
-        fprintf(stderr, "ERROR: ");   \
-        fprintf(stderr, __VA_ARGS__); \
-        fprintf(stderr, "\n");        \
-        exit(EXIT_FAILURE);           \
-    } while (0)
+static int latency_line = 0;
+static int granularity = 0;  // of the drawn series
+static bool is_stats_layout_valid = false;
+static int stats_scroll = 0;  // first visible row of the stats table
+static RankMetric rank_metric = RANK_NONE;  // of the visible window, RANK_NONE shows all cgroups
+static int top_cgroups = DEFAULT_TOP_CGROUPS;
+static bool is_ranking_valid = false;
+static double ranking_time = 0;
+
+typedef enum { PANEL_STATS, PANEL_HEATMAP, PANEL_PREEMPTIONS } Panel;
+
+static Panel bot_panel = PANEL_STATS;  // below the graph
+static Texture2D heatmap_texture;  // HEATMAP_COLUMNS x heatmap_cpus
+static int heatmap_cpus = 0;
+static int heatmap_column = 0;        // next one to be written, which is also the oldest
+static Color *heatmap_pixels = NULL;  // row per CPU, to recreate the texture once more CPUs are seen
+static Color *heatmap_column_pixels = NULL;
+static CpuLatency *heatmap_latencies = NULL;
 
 #define temp_snprintf(...)                                            \
     do {                                                              \
@@ -118,408 +152,19 @@ static bool bar_graph = true;
         if (chars >= BUFFER_SIZE) ERROR("temp buffer is too small."); \
     } while (0)
 
-#define INITIAL_VECTOR_CAPACITY 16
-
-#define VECTOR_TYPEDEF(name, type) \
-    typedef struct {               \
-        int capacity;              \
-        int length;                \
-        type *data;                \
-    } name
-
-#define VECTOR_PUSH(vec, element)                                                       \
-    do {                                                                                \
-        assert((vec) != NULL);                                                          \
-        if ((vec)->capacity == 0) {                                                     \
-            (vec)->capacity = INITIAL_VECTOR_CAPACITY;                                  \
-            (vec)->data = malloc((vec)->capacity * sizeof(*(vec)->data));               \
-            if ((vec)->data == NULL) ERROR("out of memory.");                           \
-        } else if ((vec)->capacity == (vec)->length) {                                  \
-            (vec)->capacity *= 2;                                                       \
-            (vec)->data = realloc((vec)->data, (vec)->capacity * sizeof(*(vec)->data)); \
-            if ((vec)->data == NULL) ERROR("out of memory.");                           \
-        }                                                                               \
-        (vec)->data[(vec)->length++] = (element);                                       \
-    } while (0)
-
-#define VECTOR_LAST(vec) ((vec)->length > 0 ? &(vec)->data[(vec)->length - 1] : NULL)
-
-#define VECTOR_FREE(vec)                                             \
-    do {                                                             \
-        if ((vec) != NULL && (vec)->data != NULL) free((vec)->data); \
-    } while (0)
-
-typedef struct {
-    uint64_t id;
-    char *name;
-    bool is_systemd;
-} CgroupInfo;
-
-VECTOR_TYPEDEF(CgroupInfoVec, CgroupInfo);
-
-typedef struct {
-    uint8_t did_preempt;
-    uint32_t time_s;
-    uint64_t ktime_ns;
-    uint64_t cgroup_id;
-    uint64_t latency_ns;
-} Entry;
-
-VECTOR_TYPEDEF(EntryVec, Entry);
-
-typedef struct {
-    uint64_t ktime_ns;
-    uint64_t total_latency_ns;
-    uint32_t count;
-} Latency;
-
-VECTOR_TYPEDEF(LatencyVec, Latency);
-
-typedef struct {
-    uint64_t ktime_ns;
-    uint32_t count;
-} Preempt;
-
-VECTOR_TYPEDEF(PreemptVec, Preempt);
-
-typedef struct {
-    bool is_enabled;
-
-    bool is_systemd;
-    uint64_t id;
-    Color color;
-
-    uint32_t entries_count;
-
-    LatencyVec latencies;
-    uint64_t min_latency_ns;
-    uint64_t max_latency_ns;
-    uint64_t total_latency_ns;
-    uint32_t latency_count;
-
-    PreemptVec preempts;
-    uint32_t min_preempts;
-    uint32_t max_preempts;
-    uint64_t total_preempts;
-    uint32_t preempts_count;
-} Cgroup;
-
-VECTOR_TYPEDEF(CgroupVec, Cgroup);
-
 #define MeasureText2(text, font_size) \
     MeasureTextEx(GetFontDefault(), (text), (font_size), (font_size) / GetFontDefault().baseSize)
 
-#define MAX(a, b) ((a) >= (b) ? (a) : (b))
-#define MIN(a, b) ((a) <= (b) ? (a) : (b))
-
-static void collect_cgroup_names_rec(CgroupInfoVec *cgroup_names, char *path, bool is_systemd) {
-    struct stat stats;
-    if (stat(path, &stats) == -1) ERROR("unable to stat \"%s\".", path);
-
-    CgroupInfo cgroup = {
-        .id = stats.st_ino,
-        .name = strdup(path + CGROUP_PATH_PREFIX_LENGTH),
-        .is_systemd = is_systemd,
-    };
-    VECTOR_PUSH(cgroup_names, cgroup);
-
-    DIR *dir = opendir(path);
-    if (!dir) ERROR("unable to open \"%s\".", path);
-
-    size_t path_len = strlen(path);
-
-    struct dirent *dirent;
-    while ((dirent = readdir(dir)) != NULL) {
-        if (strcmp(dirent->d_name, ".") == 0 || strcmp(dirent->d_name, "..") == 0) continue;
-        if (dirent->d_type != DT_DIR) continue;
-
-        size_t dir_len = strlen(dirent->d_name);
-        assert(path_len + dir_len + 1 < PATH_BUFFER_SIZE);
-        memcpy(path + path_len, dirent->d_name, dir_len);
-        path[path_len + dir_len] = '/';
-        path[path_len + dir_len + 1] = '\0';
-
-        bool is_cgroup_systemd = is_systemd;
-        for (size_t i = 0; i < sizeof(SYSTEMD_CGROUP_NAMES) / sizeof(*SYSTEMD_CGROUP_NAMES) && !is_cgroup_systemd;
-             i++) {
-            if (strcmp(dirent->d_name, SYSTEMD_CGROUP_NAMES[i]) == 0) is_cgroup_systemd = true;
-        }
-        collect_cgroup_names_rec(cgroup_names, path, is_cgroup_systemd);
-    }
-    closedir(dir);
-}
-
-static void collect_cgroup_names(CgroupInfoVec *cgroup_names) {
-    cgroup_names->length = 0;
-    char path[PATH_BUFFER_SIZE] = "/sys/fs/cgroup/";
-    collect_cgroup_names_rec(cgroup_names, path, false);
-}
-
-static const char *get_cgroup_name(CgroupInfoVec *cgroup_names, uint64_t id) {
-    if (id == UINT64_MAX) return "systemd services";
-
-    bool can_retry = true;
-retry:
-    for (int i = 0; i < cgroup_names->length; i++) {
-        if (cgroup_names->data[i].id == id) return cgroup_names->data[i].name;
-    }
-
-    if (!can_retry) ERROR("unable to map cgroup id to name/path.");
-    can_retry = false;
-
-    collect_cgroup_names(cgroup_names);
-    goto retry;
-}
-
-static bool is_cgroup_systemd(CgroupInfoVec *cgroup_names, uint64_t id) {
-    bool can_retry = true;
-retry:
-    for (int i = 0; i < cgroup_names->length; i++) {
-        if (cgroup_names->data[i].id == id) return cgroup_names->data[i].is_systemd;
-    }
-
-    if (!can_retry) ERROR("unable to map cgroup id to name/path.");
-    can_retry = false;
-
-    collect_cgroup_names(cgroup_names);
-    goto retry;
-}
-
-static void start_ebpf(int *ret_read_fd, pid_t *child) {
-    int fds[2];
-    if (pipe(fds) == -1) ERROR("unable to create pipe.");
-    int read_fd = fds[0];
-    int write_fd = fds[1];
-
-    if (prctl(PR_SET_PDEATHSIG, SIGTERM) == -1) ERROR("unable to set PDEATHSIG for eBPF process.");
-
-    pid_t pid = fork();
-    if (pid == -1) ERROR("unable to fork.");
-    *child = pid;
-
-    if (pid == 0) {
-        if (dup2(write_fd, fileno(stdout)) == -1) exit(EXIT_FAILURE);
-        if (close(read_fd) != 0) exit(EXIT_FAILURE);
-        execlp("ecli", "ecli", "run", "ebpf/package.json", (char *) NULL);
-        if (errno == ENOENT) exit(ENOENT);
-        exit(EXIT_FAILURE);
-    }
-
-    if (close(write_fd) != 0) ERROR("unable to close pipe's write end.");
-    if (fcntl(read_fd, F_SETFL, fcntl(read_fd, F_GETFL) | O_NONBLOCK) == -1) {
-        ERROR("unable to make pipe's read end non-blocking.");
-    }
-
-    *ret_read_fd = read_fd;
-}
-
-static const char *time_field(uint32_t *ret_s, const char *ch) {
-    assert(ret_s != NULL && ch != NULL);
-
-    char *end = NULL;
-
-    long h = strtol(ch, &end, 10);
-    assert(ch < end);
-    ch = end + 1;
-
-    long m = strtol(ch, &end, 10);
-    assert(ch < end);
-    ch = end + 1;
-
-    long s = strtol(ch, &end, 10);
-    assert(ch < end);
-
-    *ret_s = h * 3600 + m * 60 + s;
-    return end;
-}
-
-static const char *u64_field(uint64_t *ret, const char *ch) {
-    assert(ret != NULL && ch != NULL);
-
-    char *end = NULL;
-    *ret = strtoull(ch, &end, 10);
-    assert(ch < end);
-
-    return end;
-}
-
-static int read_entries(EntryVec *entries, int fd) {
-    assert(entries != NULL);
-
-    // Must hold at least one line
-    static char buffer[1024];
-    static int buffer_offset = 0;
-    static bool skipped_header = false;
-
-    ssize_t bytes;
-    while ((bytes = read(fd, buffer + buffer_offset, sizeof(buffer) - buffer_offset)) > 0) {
-        int length = buffer_offset + bytes;
-
-        int i = 0;
-        while (i < length) {
-            int line_idx = i;
-
-            while (i < length && buffer[i] != '\n') i++;
-            if (i == length) {
-                buffer_offset = length - line_idx;
-                memmove(buffer, buffer + line_idx, buffer_offset);
-                break;
-            }
-
-            i++;  // go over '\n'
-            if (i == length) buffer_offset = 0;
-
-            if (!skipped_header) {
-                skipped_header = true;
-                continue;
-            }
-
-            Entry entry = {0};
-
-            const char *ch = buffer + line_idx;
-            ch = time_field(&entry.time_s, ch);
-            uint64_t did_preempt;
-            ch = u64_field(&did_preempt, ch);
-            assert(did_preempt <= UINT8_MAX);
-            entry.did_preempt = did_preempt;
-            ch = u64_field(&entry.cgroup_id, ch);
-            ch = u64_field(&entry.latency_ns, ch);
-            ch = u64_field(&entry.ktime_ns, ch);
-            assert(*ch == '\n');
-
-            VECTOR_PUSH(entries, entry);
-        }
-    }
-    if (bytes == -1 && errno != EAGAIN) ERROR("unable to read from eBPF process.");
-    if (bytes == 0) return -1;
-
-    return 0;
-}
-
-static Cgroup *get_or_create_cgroup(CgroupVec *cgroups, CgroupInfoVec *cgroup_names, uint64_t id) {
-    if (is_cgroup_systemd(cgroup_names, id)) {
-        static int idx = -1;
-
-        if (idx == -1) {
-            Cgroup new_cgroup = {
-                .is_enabled = true,
-                .is_systemd = true,
-                .id = UINT64_MAX,
-                .color = COLORS[cgroups->length % COLORS_LEN],
-                .entries_count = 0,
-                .latencies = {0},
-                .preempts = {0},
-            };
-
-            VECTOR_PUSH(cgroups, new_cgroup);
-            idx = cgroups->length - 1;
-        }
-
-        return &cgroups->data[idx];
-    }
-
-    for (int i = 0; i < cgroups->length; i++) {
-        if (cgroups->data[i].id == id) return &cgroups->data[i];
-    }
-
-    Cgroup new_cgroup = {
-        .is_enabled = true,
-        .is_systemd = false,
-        .id = id,
-        .color = COLORS[cgroups->length % COLORS_LEN],
-        .entries_count = 0,
-        .latencies = {0},
-        .preempts = {0},
-    };
-
-    VECTOR_PUSH(cgroups, new_cgroup);
-    return &cgroups->data[cgroups->length - 1];
-}
-
-static void group_entries(CgroupVec *cgroups, CgroupInfoVec *cgroup_names, EntryVec *entries) {
-    assert(cgroups != NULL);
-
-    for (int i = 0; i < entries->length; i++) {
-        Entry entry = entries->data[i];
-
-        Cgroup *cgroup = get_or_create_cgroup(cgroups, cgroup_names, entry.cgroup_id);
-        Latency *last_latency = VECTOR_LAST(&cgroup->latencies);
-        if (last_latency != NULL && entry.ktime_ns - last_latency->ktime_ns < CGROUP_BATCHING_TIME_NS) {
-            last_latency->total_latency_ns += entry.latency_ns;
-            last_latency->count++;
-        } else {
-            if (last_latency != NULL && last_latency->count > 0) {
-                max_ktime_ns = MAX(max_ktime_ns, last_latency->ktime_ns);
-                max_latency_ns = MAX(max_latency_ns, last_latency->total_latency_ns / last_latency->count);
-            }
-
-            Latency latency = {
-                .ktime_ns = entry.ktime_ns,
-                .total_latency_ns = entry.latency_ns,
-                .count = 1,
-            };
-            VECTOR_PUSH(&cgroup->latencies, latency);
-        }
-        cgroup->entries_count++;
-
-        if (!entry.did_preempt) continue;
-
-        Preempt *last_preempt = VECTOR_LAST(&cgroup->preempts);
-        if (last_preempt != NULL && entry.ktime_ns - last_preempt->ktime_ns < CGROUP_BATCHING_TIME_NS) {
-            last_preempt->count++;
-        } else {
-            if (last_preempt != NULL) {
-                max_ktime_ns = MAX(max_ktime_ns, last_preempt->ktime_ns);
-                max_preempts = MAX(max_preempts, last_preempt->count);
-            }
-
-            Preempt preempt = {
-                .ktime_ns = entry.ktime_ns,
-                .count = 1,
-            };
-            VECTOR_PUSH(&cgroup->preempts, preempt);
-        }
-    }
-    entries->length = 0;
-
-    for (int i = 0; i < cgroups->length; i++) {
-        Cgroup *cgroup = &cgroups->data[i];
-
-        Latency *last_latency = VECTOR_LAST(&cgroup->latencies);
-        if (last_latency != NULL && last_latency->count > 0 && last_latency->ktime_ns < max_ktime_ns
-            && max_ktime_ns - last_latency->ktime_ns > CGROUP_ZERO_POINT_TIME_NS) {
-            max_latency_ns = MAX(max_latency_ns, last_latency->total_latency_ns / last_latency->count);
-
-            Latency latency = {
-                .ktime_ns = max_ktime_ns,
-                .total_latency_ns = 0,
-                .count = 0,
-            };
-            VECTOR_PUSH(&cgroup->latencies, latency);
-        }
-
-        Preempt *last_preempt = VECTOR_LAST(&cgroup->preempts);
-        if (last_preempt != NULL && last_preempt->count > 0 && last_preempt->ktime_ns < max_ktime_ns
-            && max_ktime_ns - last_preempt->ktime_ns > CGROUP_ZERO_POINT_TIME_NS) {
-            max_preempts = MAX(max_preempts, last_preempt->count);
-
-            Preempt preempt = {
-                .ktime_ns = max_ktime_ns,
-                .count = 0,
-            };
-            VECTOR_PUSH(&cgroup->preempts, preempt);
-        }
-    }
-}
-
-static void temp_print_scaled_latency(uint64_t latency_ns) {
+static void print_scaled_latency(char *dst, int size, uint64_t latency_ns) {
     if (latency_ns >= NS_IN_MS) {
-        temp_snprintf("%lums", latency_ns / NS_IN_MS);
+        snprintf(dst, size, "%lums", latency_ns / NS_IN_MS);
     } else {
-        temp_snprintf("%luus", latency_ns / NS_IN_US);
+        snprintf(dst, size, "%luus", latency_ns / NS_IN_US);
     }
 }
 
+static void temp_print_scaled_latency(uint64_t latency_ns) { print_scaled_latency(buffer, BUFFER_SIZE, latency_ns); }
+
 static int draw_x_axis() {
     int max_y = 0;
     for (int i = 0; i <= graph_width / GRID_SIZE; i++) {
@@ -548,11 +193,13 @@ static int draw_x_axis() {
 }
 
 static void draw_y_axis() {
-    Vector2 td = MeasureText2("Latency", AXIS_LABEL_FONT_SIZE);
-    DrawText("Latency", HOR_PADDING - td.x / 2, TOP_PADDING - td.y - TEXT_MARGIN, AXIS_LABEL_FONT_SIZE, FOREGROUND);
+    temp_snprintf("Latency (%s per %s)", LATENCY_LINES[latency_line].name, GRANULARITIES[granularity].name);
+    Vector2 td = MeasureText2(buffer, AXIS_LABEL_FONT_SIZE);
+    DrawText(buffer, HOR_PADDING - td.x / 2, TOP_PADDING - td.y - TEXT_MARGIN, AXIS_LABEL_FONT_SIZE, FOREGROUND);
 
-    td = MeasureText2("Preemptions", AXIS_LABEL_FONT_SIZE);
-    DrawText("Preemptions", width - HOR_PADDING - td.x / 2, TOP_PADDING - td.y - TEXT_MARGIN, AXIS_LABEL_FONT_SIZE,
+    temp_snprintf("Preemptions (per %s)", GRANULARITIES[granularity].name);
+    td = MeasureText2(buffer, AXIS_LABEL_FONT_SIZE);
+    DrawText(buffer, width - HOR_PADDING - td.x / 2, TOP_PADDING - td.y - TEXT_MARGIN, AXIS_LABEL_FONT_SIZE,
              FOREGROUND);
 
     for (int i = 0; i <= graph_height / GRID_SIZE; i++) {
@@ -571,10 +218,43 @@ static void draw_y_axis() {
     }
 }
 
-static void draw_legend(CgroupVec cgroups) {
-    int x = HOR_PADDING;
+typedef struct {
+    uint64_t value;
+    int cgroup_idx;
+} RankedCgroup;
+
+VECTOR_TYPEDEF(RankedCgroupVec, RankedCgroup);
+VECTOR_TYPEDEF(IntVec, int);
+
+static RankedCgroupVec top_heap = {0};
+static IntVec shown_cgroups = {0};  // indices of the graph's cgroups in tree order, see select_shown_cgroups
+static IntVec previous_shown_cgroups = {0};
+
+// Collapsed cgroups hide their subtrees, their series already include them
+static void update_visibility(CgroupVec cgroups) {
+    // Parents precede their children, so one pass is enough
     for (int i = 0; i < cgroups.length; i++) {
         Cgroup *cgroup = &cgroups.data[i];
+        if (cgroup->parent_idx == -1) {
+            cgroup->is_visible = true;
+        } else {
+            const Cgroup *parent = &cgroups.data[cgroup->parent_idx];
+            cgroup->is_visible = parent->is_visible && parent->is_expanded;
+        }
+    }
+}
+
+static void draw_legend(CgroupVec cgroups) {
+    int x = HOR_PADDING;
+    if (rank_metric != RANK_NONE) {
+        temp_snprintf("Top %d by %s:", top_cgroups, RANK_METRIC_NAMES[rank_metric]);
+        Vector2 td = MeasureText2(buffer, LEGEND_FONT_SIZE);
+        DrawText(buffer, x, LEGEND_TOP_MARGIN - td.y / 2, LEGEND_FONT_SIZE, FOREGROUND);
+        x += td.x + LEGEND_PADDING;
+    }
+
+    for (int i = 0; i < shown_cgroups.length; i++) {
+        Cgroup *cgroup = &cgroups.data[shown_cgroups.data[i]];
 
         Rectangle rec = {
             .x = x,
@@ -584,9 +264,9 @@ static void draw_legend(CgroupVec cgroups) {
         };
 
         if (cgroup->is_enabled) {
-            DrawRectangleRec(rec, cgroup->color);
+            DrawRectangleRec(rec, COLORS[cgroup->color_idx]);
         } else {
-            DrawRectangleLinesEx(rec, LEGEND_COLOR_THICKNESS, cgroup->color);
+            DrawRectangleLinesEx(rec, LEGEND_COLOR_THICKNESS, COLORS[cgroup->color_idx]);
         }
         x += LEGEND_COLOR_SIZE + LEGEND_COLOR_PADDING;
 
@@ -595,6 +275,7 @@ static void draw_legend(CgroupVec cgroups) {
             SetMouseCursor(MOUSE_CURSOR_POINTING_HAND);
 
             if (IsMouseButtonPressed(MOUSE_BUTTON_LEFT)) {
+                is_stats_layout_valid = false;
                 if (IsKeyDown(KEY_LEFT_SHIFT)) {
                     for (int j = 0; j < cgroups.length; j++) cgroups.data[j].is_enabled = false;
                     cgroup->is_enabled = true;
@@ -602,26 +283,115 @@ static void draw_legend(CgroupVec cgroups) {
                     cgroup->is_enabled = !cgroup->is_enabled;
                 }
             }
+            if (IsMouseButtonPressed(MOUSE_BUTTON_RIGHT)) {
+                cgroup->is_pinned = !cgroup->is_pinned;
+                is_ranking_valid = false;
+            }
         }
 
-        if (cgroup->is_systemd) temp_snprintf("systemd services");
-        else temp_snprintf("%lu", cgroup->id);
+        // Pinned ones are marked with '*'
+        const char *pin = cgroup->is_pinned ? "*" : "";
+        if (cgroup->id != 0) temp_snprintf("%lu%s", cgroup->id, pin);
+        else temp_snprintf("%s%s", cgroup->short_name, pin);
 
         Vector2 td = MeasureText2(buffer, LEGEND_FONT_SIZE);
-        DrawText(buffer, x, LEGEND_TOP_MARGIN - td.y / 2, LEGEND_FONT_SIZE, cgroup->color);
+        DrawText(buffer, x, LEGEND_TOP_MARGIN - td.y / 2, LEGEND_FONT_SIZE, COLORS[cgroup->color_idx]);
         x += td.x + LEGEND_PADDING;
     }
 }
 
-static void draw_graph_line(double px, double py, double x, double y, Color color) {
+VECTOR_TYPEDEF(Vector2Vec, Vector2);
+
+// Visible part of a series as pairs of line ends in screen space, rebuilt only when its data or the view changes
+typedef struct {
+    uint32_t data_version;
+    uint32_t view_version;
+    Vector2Vec vertices;
+    Vector2Vec envelope;  // min to max of the aggregated points, so that zooming out doesn't hide spikes
+} SeriesLines;
+
+typedef struct {
+    SeriesLines latency;
+    SeriesLines preempts;
+} CgroupLines;
+
+VECTOR_TYPEDEF(CgroupLinesVec, CgroupLines);
+
+static CgroupLinesVec cgroup_lines = {0};  // parallel to the graph's cgroups
+static uint32_t view_version = 0;
+
+// Keeps a zoomed in view the same width in time as the data grows, so that it isn't rebuilt every frame.
+// A view at the end keeps following it, otherwise the view stays at the same time.
+static void keep_view_window(uint64_t prev_min_ktime_ns, uint64_t prev_max_ktime_ns) {
+    if (x_scale <= 1.0 || prev_max_ktime_ns <= prev_min_ktime_ns || max_ktime_ns <= min_ktime_ns) return;
+
+    double prev_range_ns = prev_max_ktime_ns - prev_min_ktime_ns;
+    double range_ns = max_ktime_ns - min_ktime_ns;
+    double window_ns = prev_range_ns / x_scale;
+    double start_ktime_ns = prev_min_ktime_ns + prev_range_ns * x_offset;
+    bool at_end = x_offset >= 1.0 - 1.0 / x_scale - VIEW_END_EPSILON;
+
+    x_scale = MAX(range_ns / window_ns, 1.0);
+    if (at_end) x_offset = 1.0 - 1.0 / x_scale;
+    else x_offset = MIN(MAX((start_ktime_ns - min_ktime_ns) / range_ns, 0.0), 1.0 - 1.0 / x_scale);
+}
+
+// Everything that the projection of points depends on besides the data
+typedef struct {
+    int width;
+    int height;
+    uint64_t start_ktime_ns;  // of the visible window, not of the data, which grows every frame in live mode
+    uint64_t end_ktime_ns;
+    double latency_y_scale;
+    double preempts_y_scale;
+    uint64_t max_latency_ns;
+    uint32_t max_preempts;
+    bool bar_graph;
+    int latency_line;
+    int granularity;
+} View;
+
+static void update_view_version(void) {
+    static View prev_view = {0};
+
+    // Zeroed so that padding compares equal
+    View view;
+    memset(&view, 0, sizeof(view));
+    view.width = width;
+    view.height = height;
+    // Rounded since the offset and the scale are rederived from it when the data grows
+    double range_ns = max_ktime_ns - min_ktime_ns;
+    view.start_ktime_ns = llround(min_ktime_ns + range_ns * x_offset);
+    view.end_ktime_ns = llround(min_ktime_ns + range_ns * x_offset + range_ns / x_scale);
+    view.latency_y_scale = latency_y_scale;
+    view.preempts_y_scale = preempts_y_scale;
+    view.max_latency_ns = max_latency_ns;
+    view.max_preempts = max_preempts;
+    view.bar_graph = bar_graph;
+    view.latency_line = latency_line;
+    view.granularity = granularity;
+
+    if (memcmp(&view, &prev_view, sizeof(view)) != 0) {
+        memcpy(&prev_view, &view, sizeof(view));
+        view_version++;
+    }
+}
+
+// Coordinates are truncated the same way as by DrawLine
+static void add_line(Vector2Vec *vertices, int x1, int y1, int x2, int y2) {
+    VECTOR_PUSH(vertices, ((Vector2) {x1, y1}));
+    VECTOR_PUSH(vertices, ((Vector2) {x2, y2}));
+}
+
+static void add_graph_line(Vector2Vec *vertices, double px, double py, double x, double y) {
     if (bar_graph) {
         double rpx = HOR_PADDING + MAX(px, 0);
         double rx = MIN(HOR_PADDING + x, width - HOR_PADDING);
         double rpy = height - bot_padding - MIN(py, graph_height);
         double ry = height - bot_padding - MIN(y, graph_height);
 
-        if (py <= graph_height) DrawLine(rpx, rpy, rx, rpy, color);
-        if (x <= graph_width) DrawLine(rx, rpy, rx, ry, color);
+        if (py <= graph_height) add_line(vertices, rpx, rpy, rx, rpy);
+        if (x <= graph_width) add_line(vertices, rx, rpy, rx, ry);
     } else {
         double rpx = px;
         double rpy = py;
@@ -652,227 +422,806 @@ static void draw_graph_line(double px, double py, double x, double y, Color colo
             ry = graph_height;
         }
 
-        DrawLine(HOR_PADDING + rpx, height - bot_padding - rpy, HOR_PADDING + rx, height - bot_padding - ry, color);
+        add_line(vertices, HOR_PADDING + rpx, height - bot_padding - rpy, HOR_PADDING + rx, height - bot_padding - ry);
+    }
+}
+
+// Projects series using the coarsest level of detail which still has a point per pixel.
+// The value is the average, or the quantile of the points' sketches unless they are NULL. Averages of aggregated
+// points also get an envelope of their min and max.
+static void build_series_lines(SeriesLines *lines, const void *series, int length, LodGetPoint get_point,
+                               const Lod *lod, const SketchVec *sketches, double quantile, double value_per_px,
+                               double y_scale) {
+    lines->vertices.length = 0;
+    lines->envelope.length = 0;
+
+    double points_per_px = ktime_per_px / x_scale / GRANULARITIES[granularity].point_ns;
+    int level = lod_level_for(lod, points_per_px);
+    if (level != -1) {
+        series = &lod->levels[level];
+        length = lod->levels[level].length;
+        get_point = get_lod_level_point;
+        if (sketches != NULL) sketches = &lod->sketch_levels[level];
+    }
+
+    // Start from the last point before the visible part to draw the line coming into it
+    uint64_t start_ktime_ns = min_ktime_ns + (max_ktime_ns - min_ktime_ns) * x_offset;
+    int start = MAX(lod_find(series, length, get_point, start_ktime_ns) - 1, 0);
+
+    double px = -1;
+    double py = -1;
+    double npx = -1;
+    double npy = -1;
+    for (int j = start; j < length; j++, px = npx, py = npy) {
+        LodPoint point = get_point(series, j);
+        double value = sketches == NULL ? point.total / ((double) point.points)
+                                        : (double) sketch_quantile(&sketches->data[j], quantile);
+
+        double x = (point.ktime_ns - min_ktime_ns - (max_ktime_ns - min_ktime_ns) * x_offset) / ktime_per_px * x_scale;
+        double y = value / value_per_px * y_scale;
+
+        npx = x;
+        npy = y;
+
+        if (x < 0) continue;
+        if (x > graph_width && px > graph_width) break;
+        if (px > x) continue;
+        if (y > graph_height && py > graph_height) continue;
+        if (px == -1) continue;
+
+        add_graph_line(&lines->vertices, px, py, x, y);
+        if (level != -1 && sketches == NULL && x <= graph_width && point.min < point.max) {
+            double min_y = MIN(point.min / value_per_px * y_scale, graph_height);
+            double max_y = MIN(point.max / value_per_px * y_scale, graph_height);
+            add_line(&lines->envelope, HOR_PADDING + x, height - bot_padding - min_y, HOR_PADDING + x,
+                     height - bot_padding - max_y);
+        }
     }
+    if (px > 0 && px < graph_width) add_graph_line(&lines->vertices, px, py, graph_width, py);
+}
+
+// Lines are drawn in chunks which fit into rlgl's batch
+static void draw_vertices(const Vector2Vec *vertices, Color color) {
+    for (int i = 0; i < vertices->length; i += LINE_BATCH_VERTICES) {
+        int length = MIN(vertices->length - i, LINE_BATCH_VERTICES);
+
+        rlCheckRenderBatchLimit(length);
+        rlBegin(RL_LINES);
+        rlColor4ub(color.r, color.g, color.b, color.a);
+        for (int j = i; j < i + length; j++) rlVertex2f(vertices->data[j].x, vertices->data[j].y);
+        rlEnd();
+    }
+}
+
+// Envelope is faded and drawn below the line
+static void draw_series_lines(const SeriesLines *lines, Color color) {
+    draw_vertices(&lines->envelope, ColorAlpha(color, ENVELOPE_ALPHA));
+    draw_vertices(&lines->vertices, color);
 }
 
 static void draw_graph(CgroupVec cgroups) {
-    for (int i = 0; i < cgroups.length; i++) {
+    while (cgroup_lines.length < cgroups.length) VECTOR_PUSH(&cgroup_lines, (CgroupLines) {0});
+
+    for (int k = 0; k < shown_cgroups.length; k++) {
+        int i = shown_cgroups.data[k];
         Cgroup *cgroup = &cgroups.data[i];
         if (!cgroup->is_enabled) continue;
 
+        const Series *series = &cgroup->series[granularity];
+
         if (draw_latency) {
-            // Reset stats
-            cgroup->min_latency_ns = UINT64_MAX;
-            cgroup->max_latency_ns = 0;
-            cgroup->total_latency_ns = 0;
-            cgroup->latency_count = 0;
-
-            double px = -1;
-            double py = -1;
-            double npx = -1;
-            double npy = -1;
-            for (int j = 0; j < cgroup->latencies.length; j++, px = npx, py = npy) {
-                Latency point = cgroup->latencies.data[j];
-                double latency = point.count > 0 ? point.total_latency_ns / ((double) point.count) : 0;
-
-                double x = (point.ktime_ns - min_ktime_ns - (max_ktime_ns - min_ktime_ns) * x_offset) / ktime_per_px
-                           * x_scale;
-                double y = latency / latency_per_px * latency_y_scale;
-
-                npx = x;
-                npy = y;
-
-                if (x < 0) continue;
-                if (x > graph_width && px > graph_width) break;
-                if (px > x) continue;
-
-                cgroup->min_latency_ns = MIN(cgroup->min_latency_ns, latency);
-                cgroup->max_latency_ns = MAX(cgroup->max_latency_ns, latency);
-                cgroup->total_latency_ns += latency;
-                cgroup->latency_count++;
-
-                if (y > graph_height && py > graph_height) continue;
-                if (px == -1) continue;
-
-                draw_graph_line(px, py, x, y, cgroup->color);
+            SeriesLines *lines = &cgroup_lines.data[i].latency;
+            if (lines->view_version != view_version || lines->data_version != series->latencies_version) {
+                lines->data_version = series->latencies_version;
+                lines->view_version = view_version;
+                double quantile = LATENCY_LINES[latency_line].quantile;
+                build_series_lines(lines, &series->latencies, series->latencies.length, get_latency_lod_point,
+                                   &series->latency_lod, quantile < 0 ? NULL : &series->sketches, quantile,
+                                   latency_per_px, latency_y_scale);
             }
-            if (px > 0 && px < graph_width) draw_graph_line(px, py, graph_width, py, cgroup->color);
+            draw_series_lines(lines, COLORS[cgroup->color_idx]);
         }
 
         if (draw_preempts) {
-            // Reset stats
-            cgroup->min_preempts = UINT32_MAX;
-            cgroup->max_preempts = 0;
-            cgroup->total_preempts = 0;
-            cgroup->preempts_count = 0;
-
-            Vector3 hsv = ColorToHSV(cgroup->color);
+            Vector3 hsv = ColorToHSV(COLORS[cgroup->color_idx]);
             Color preempt_color = ColorFromHSV(hsv.x, hsv.y * 0.5f, hsv.z * 0.5f);
 
-            double px = -1;
-            double py = -1;
-            double npx = -1;
-            double npy = -1;
-            for (int j = 0; j < cgroup->preempts.length; j++, px = npx, py = npy) {
-                Preempt point = cgroup->preempts.data[j];
+            SeriesLines *lines = &cgroup_lines.data[i].preempts;
+            if (lines->view_version != view_version || lines->data_version != series->preempts_version) {
+                lines->data_version = series->preempts_version;
+                lines->view_version = view_version;
+                build_series_lines(lines, &series->preempts, series->preempts.length, get_preempt_lod_point,
+                                   &series->preempts_lod, NULL, -1, preempts_per_px, preempts_y_scale);
+            }
+            draw_series_lines(lines, preempt_color);
+        }
+    }
+}
+
+static void get_visible_window(uint64_t *start_ktime_ns, uint64_t *end_ktime_ns) {
+    *start_ktime_ns = min_ktime_ns + (max_ktime_ns - min_ktime_ns) * x_offset;
+    *end_ktime_ns = *start_ktime_ns + (max_ktime_ns - min_ktime_ns) / x_scale;
+}
 
-                double x = (point.ktime_ns - min_ktime_ns - (max_ktime_ns - min_ktime_ns) * x_offset) / ktime_per_px
-                           * x_scale;
-                double y = point.count / preempts_per_px * preempts_y_scale;
+static LodPoint query_latencies(const Series *series, uint64_t start_ktime_ns, uint64_t end_ktime_ns) {
+    const LatencyVec *latencies = &series->latencies;
+    int from = lod_find(latencies, latencies->length, get_latency_lod_point, start_ktime_ns);
+    int to = lod_find(latencies, latencies->length, get_latency_lod_point, end_ktime_ns + 1);
+    return lod_query(&series->latency_lod, latencies, get_latency_lod_point, from, to);
+}
 
-                npx = x;
-                npy = y;
+// Quantiles come from the finest granularity with sketches, so their range is rounded to its points
+static Sketch query_latency_sketch(const Cgroup *cgroup, uint64_t start_ktime_ns, uint64_t end_ktime_ns) {
+    const Series *series = &cgroup->series[MAX(granularity, FIRST_SKETCH_GRANULARITY)];
+    const LatencyVec *latencies = &series->latencies;
+    int from = lod_find(latencies, latencies->length, get_latency_lod_point, start_ktime_ns);
+    int to = lod_find(latencies, latencies->length, get_latency_lod_point, end_ktime_ns + 1);
+    return lod_query_sketch(&series->latency_lod, &series->sketches, from, to);
+}
 
-                if (x < 0) continue;
-                if (x > graph_width && px > graph_width) break;
-                if (px > x) continue;
+static LodPoint query_preempts(const Series *series, uint64_t start_ktime_ns, uint64_t end_ktime_ns) {
+    const PreemptVec *preempts = &series->preempts;
+    int from = lod_find(preempts, preempts->length, get_preempt_lod_point, start_ktime_ns);
+    int to = lod_find(preempts, preempts->length, get_preempt_lod_point, end_ktime_ns + 1);
+    return lod_query(&series->preempts_lod, preempts, get_preempt_lod_point, from, to);
+}
 
-                cgroup->min_preempts = MIN(cgroup->min_preempts, point.count);
-                cgroup->max_preempts = MAX(cgroup->max_preempts, point.count);
-                cgroup->total_preempts += point.count;
-                cgroup->preempts_count++;
+// Queries stats of the points in the visible time range from the level of detail pyramids, O(log n) per series.
+// Only the shown cgroups are queried, ranking queries just its metric.
+static void update_stats(CgroupVec cgroups) {
+    if (max_ktime_ns < min_ktime_ns) return;
+
+    uint64_t start_ktime_ns, end_ktime_ns;
+    get_visible_window(&start_ktime_ns, &end_ktime_ns);
+
+    for (int k = 0; k < shown_cgroups.length; k++) {
+        Cgroup *cgroup = &cgroups.data[shown_cgroups.data[k]];
+        const Series *series = &cgroup->series[granularity];
+
+        LodPoint stats = query_latencies(series, start_ktime_ns, end_ktime_ns);
+        cgroup->min_latency_ns = stats.min;
+        cgroup->max_latency_ns = stats.max;
+        cgroup->total_latency_ns = stats.total;
+        cgroup->latency_count = stats.points;
+
+        Sketch sketch = query_latency_sketch(cgroup, start_ktime_ns, end_ktime_ns);
+        cgroup->p50_latency_ns = sketch_quantile(&sketch, 0.5);
+        cgroup->p99_latency_ns = sketch_quantile(&sketch, 0.99);
+        cgroup->p999_latency_ns = sketch_quantile(&sketch, 0.999);
+        sketch_free(&sketch);
+
+        stats = query_preempts(series, start_ktime_ns, end_ktime_ns);
+        cgroup->min_preempts = MIN(stats.min, UINT32_MAX);
+        cgroup->max_preempts = stats.max;
+        cgroup->total_preempts = stats.total;
+        cgroup->preempts_count = stats.points;
+    }
+}
 
-                if (y > graph_height && py > graph_width) continue;
-                if (px == -1) continue;
+static uint64_t get_rank_value(const Cgroup *cgroup, uint64_t start_ktime_ns, uint64_t end_ktime_ns) {
+    if (rank_metric == RANK_AVG_LATENCY) {
+        LodPoint stats = query_latencies(&cgroup->series[granularity], start_ktime_ns, end_ktime_ns);
+        return stats.points > 0 ? stats.total / stats.points : 0;
+    }
+    if (rank_metric == RANK_P99_LATENCY) {
+        Sketch sketch = query_latency_sketch(cgroup, start_ktime_ns, end_ktime_ns);
+        uint64_t p99_latency_ns = sketch_quantile(&sketch, 0.99);
+        sketch_free(&sketch);
+        return p99_latency_ns;
+    }
+    return query_preempts(&cgroup->series[granularity], start_ktime_ns, end_ktime_ns).total;
+}
 
-                draw_graph_line(px, py, x, y, preempt_color);
-            }
-            if (px > 0 && px < graph_width) draw_graph_line(px, py, graph_width, py, preempt_color);
+// Keeps the top_cgroups worst ones in a min-heap, so its root is the first to be replaced
+static void push_ranked_cgroup(RankedCgroup ranked) {
+    RankedCgroup *heap = top_heap.data;
+    if (top_heap.length < top_cgroups) {
+        VECTOR_PUSH(&top_heap, ranked);
+        heap = top_heap.data;
+        for (int i = top_heap.length - 1; i > 0 && heap[(i - 1) / 2].value > heap[i].value; i = (i - 1) / 2) {
+            RankedCgroup temp = heap[i];
+            heap[i] = heap[(i - 1) / 2];
+            heap[(i - 1) / 2] = temp;
         }
+        return;
+    }
+    if (ranked.value <= heap[0].value) return;
+
+    heap[0] = ranked;
+    int i = 0;
+    while (true) {
+        int min = i;
+        int left = 2 * i + 1, right = 2 * i + 2;
+        if (left < top_heap.length && heap[left].value < heap[min].value) min = left;
+        if (right < top_heap.length && heap[right].value < heap[min].value) min = right;
+        if (min == i) break;
+
+        RankedCgroup temp = heap[i];
+        heap[i] = heap[min];
+        heap[min] = temp;
+        i = min;
     }
 }
 
-static void draw_stats(int start_y, CgroupVec cgroups, CgroupInfoVec *cgroup_names) {
-    Vector2 id_column_dim = MeasureText2("Id", STATS_LABEL_FONT_SIZE);
-    int id_column_width = id_column_dim.x;
-    int name_column_width = MeasureText("Name", STATS_LABEL_FONT_SIZE);
-    int min_latency_column_width = MeasureText("Min latency", STATS_LABEL_FONT_SIZE);
-    int max_latency_column_width = MeasureText("Max latency", STATS_LABEL_FONT_SIZE);
-    int avg_latency_column_width = MeasureText("Avg latency", STATS_LABEL_FONT_SIZE);
-    int min_preempts_column_width = MeasureText("Min preempts", STATS_LABEL_FONT_SIZE);
-    int max_preempts_column_width = MeasureText("Max preempts", STATS_LABEL_FONT_SIZE);
-    int avg_preempts_column_width = MeasureText("Avg preempts", STATS_LABEL_FONT_SIZE);
-    for (int i = 0; i < cgroups.length; i++) {
-        Cgroup cgroup = cgroups.data[i];
-        if (!cgroup.is_enabled) continue;
+static int compare_ints(const void *a, const void *b) { return *(const int *) a - *(const int *) b; }
 
-        if (!cgroup.is_systemd) {
-            temp_snprintf("%lu", cgroup.id);
-        } else {
-            temp_snprintf("null");
+static bool was_shown(int cgroup_idx) {
+    // Shown cgroups are sorted
+    if (previous_shown_cgroups.length == 0) return false;
+    return bsearch(&cgroup_idx, previous_shown_cgroups.data, previous_shown_cgroups.length,
+                   sizeof(*previous_shown_cgroups.data), compare_ints)
+           != NULL;
+}
+
+// Shown cgroups keep their colors, the rest take the first ones unused by the others, so that shown ones differ when
+// there are enough colors.
+static void assign_colors(CgroupVec cgroups) {
+    bool is_used[COLORS_LEN] = {0};
+    for (int k = 0; k < shown_cgroups.length; k++) {
+        if (was_shown(shown_cgroups.data[k])) is_used[cgroups.data[shown_cgroups.data[k]].color_idx] = true;
+    }
+
+    int next_color = 0;
+    for (int k = 0; k < shown_cgroups.length; k++) {
+        if (was_shown(shown_cgroups.data[k])) continue;
+
+        while (next_color < (int) COLORS_LEN && is_used[next_color]) next_color++;
+        if (next_color == COLORS_LEN) break;  // the rest keep theirs
+
+        Cgroup *cgroup = &cgroups.data[shown_cgroups.data[k]];
+        cgroup->color_idx = next_color;
+        is_used[next_color] = true;
+    }
+}
+
+// Selects the cgroups of the legend, graph and stats table: all visible ones, or only the worst ones by the metric and
+// the pinned ones, so that drawing and measuring scale with their number. Expanded cgroups aren't ranked, as their
+// children are. Ranking is O(n log k) and is redone every RANK_INTERVAL_S, or right away when its inputs change.
+static void select_shown_cgroups(CgroupVec cgroups) {
+    double now = GetTime();
+    if (rank_metric != RANK_NONE && is_ranking_valid && now - ranking_time < RANK_INTERVAL_S) return;
+    is_ranking_valid = true;
+    ranking_time = now;
+
+    uint64_t start_ktime_ns, end_ktime_ns;
+    get_visible_window(&start_ktime_ns, &end_ktime_ns);
+
+    IntVec previous = previous_shown_cgroups;
+    previous_shown_cgroups = shown_cgroups;
+    shown_cgroups = previous;
+    shown_cgroups.length = 0;
+
+    if (rank_metric == RANK_NONE) {
+        for (int i = 0; i < cgroups.length; i++) {
+            if (cgroups.data[i].is_visible) VECTOR_PUSH(&shown_cgroups, i);
         }
-        id_column_width = MAX(id_column_width, MeasureText(buffer, STATS_DATA_FONT_SIZE));
+    } else {
+        top_heap.length = 0;
+        for (int i = 0; i < cgroups.length; i++) {
+            const Cgroup *cgroup = &cgroups.data[i];
+            if (!cgroup->is_visible) continue;
+
+            if (cgroup->is_pinned) {
+                VECTOR_PUSH(&shown_cgroups, i);
+            } else if (!cgroup->has_children || !cgroup->is_expanded) {
+                uint64_t value = get_rank_value(cgroup, start_ktime_ns, end_ktime_ns);
+                push_ranked_cgroup((RankedCgroup) {.value = value, .cgroup_idx = i});
+            }
+        }
+        for (int i = 0; i < top_heap.length; i++) VECTOR_PUSH(&shown_cgroups, top_heap.data[i].cgroup_idx);
 
-        temp_snprintf("%s", get_cgroup_name(cgroup_names, cgroup.id));
-        name_column_width = MAX(name_column_width, MeasureText(buffer, STATS_DATA_FONT_SIZE));
+        // Tree order is kept, so the ranking doesn't reorder rows every frame
+        qsort(shown_cgroups.data, shown_cgroups.length, sizeof(*shown_cgroups.data), compare_ints);
+    }
+    assign_colors(cgroups);
 
-        if (cgroup.latency_count > 0) {
-            temp_print_scaled_latency(cgroup.min_latency_ns);
-            min_latency_column_width = MAX(min_latency_column_width, MeasureText(buffer, STATS_DATA_FONT_SIZE));
+    // Column widths depend on the shown rows
+    if (shown_cgroups.length != previous_shown_cgroups.length
+        || memcmp(shown_cgroups.data, previous_shown_cgroups.data, shown_cgroups.length * sizeof(int)) != 0) {
+        is_stats_layout_valid = false;
+    }
+}
 
-            temp_print_scaled_latency(cgroup.max_latency_ns);
-            max_latency_column_width = MAX(max_latency_column_width, MeasureText(buffer, STATS_DATA_FONT_SIZE));
+static void free_cgroup_lines(void) {
+    for (int i = 0; i < cgroup_lines.length; i++) {
+        VECTOR_FREE(&cgroup_lines.data[i].latency.vertices);
+        VECTOR_FREE(&cgroup_lines.data[i].latency.envelope);
+        VECTOR_FREE(&cgroup_lines.data[i].preempts.vertices);
+        VECTOR_FREE(&cgroup_lines.data[i].preempts.envelope);
+    }
+    VECTOR_FREE(&cgroup_lines);
+}
 
-            temp_print_scaled_latency(cgroup.total_latency_ns / cgroup.latency_count);
-            avg_latency_column_width = MAX(avg_latency_column_width, MeasureText(buffer, STATS_DATA_FONT_SIZE));
+enum {
+    COLUMN_ID,
+    COLUMN_NAME,
+    COLUMN_MIN_LATENCY,
+    COLUMN_MAX_LATENCY,
+    COLUMN_AVG_LATENCY,
+    COLUMN_P50_LATENCY,
+    COLUMN_P99_LATENCY,
+    COLUMN_P999_LATENCY,
+    COLUMN_MIN_PREEMPTS,
+    COLUMN_MAX_PREEMPTS,
+    COLUMN_AVG_PREEMPTS,
+    COLUMNS_COUNT,
+};
+
+static const char *COLUMN_LABELS[COLUMNS_COUNT] = {
+    "Id",          "Name",          "Min latency",  "Max latency",  "Avg latency", "p50 latency",
+    "p99 latency", "p99.9 latency", "Min preempts", "Max preempts", "Avg preempts",
+};
+
+// Everything a row is formatted from
+typedef struct {
+    uint64_t latency_count;
+    uint64_t min_latency_ns;
+    uint64_t max_latency_ns;
+    uint64_t total_latency_ns;
+    uint64_t p50_latency_ns;
+    uint64_t p99_latency_ns;
+    uint64_t p999_latency_ns;
+    uint64_t preempts_count;
+    uint64_t min_preempts;
+    uint64_t max_preempts;
+    uint64_t total_preempts;
+} StatsValues;
+
+// Row of the stats table, formatted and measured only when its values change
+typedef struct {
+    bool is_formatted;
+    StatsValues values;
+    char cells[COLUMNS_COUNT][STATS_CELL_SIZE];  // name is the cgroup's
+    int widths[COLUMNS_COUNT];
+} StatsRow;
+
+VECTOR_TYPEDEF(StatsRowVec, StatsRow);
+
+static StatsRowVec stats_rows = {0};  // parallel to the graph's cgroups
+static int stats_column_widths[COLUMNS_COUNT];
+static int stats_label_height;
+static int stats_row_height;
+
+static StatsValues get_stats_values(const Cgroup *cgroup) {
+    return (StatsValues) {
+        .latency_count = cgroup->latency_count,
+        .min_latency_ns = cgroup->min_latency_ns,
+        .max_latency_ns = cgroup->max_latency_ns,
+        .total_latency_ns = cgroup->total_latency_ns,
+        .p50_latency_ns = cgroup->p50_latency_ns,
+        .p99_latency_ns = cgroup->p99_latency_ns,
+        .p999_latency_ns = cgroup->p999_latency_ns,
+        .preempts_count = cgroup->preempts_count,
+        .min_preempts = cgroup->min_preempts,
+        .max_preempts = cgroup->max_preempts,
+        .total_preempts = cgroup->total_preempts,
+    };
+}
+
+// Names are indented by their depth in the tree
+static int get_name_indent(const Cgroup *cgroup) { return (cgroup->depth + 1) * STATS_INDENT_WIDTH; }
+
+static void format_stats_row(StatsRow *row, const Cgroup *cgroup, StatsValues values) {
+    row->is_formatted = true;
+    row->values = values;
+
+    if (cgroup->id != 0) {
+        snprintf(row->cells[COLUMN_ID], STATS_CELL_SIZE, "%lu", cgroup->id);
+    } else {
+        snprintf(row->cells[COLUMN_ID], STATS_CELL_SIZE, "null");
+    }
+
+    if (values.latency_count > 0) {
+        print_scaled_latency(row->cells[COLUMN_MIN_LATENCY], STATS_CELL_SIZE, values.min_latency_ns);
+        print_scaled_latency(row->cells[COLUMN_MAX_LATENCY], STATS_CELL_SIZE, values.max_latency_ns);
+        print_scaled_latency(row->cells[COLUMN_AVG_LATENCY], STATS_CELL_SIZE,
+                             values.total_latency_ns / values.latency_count);
+        print_scaled_latency(row->cells[COLUMN_P50_LATENCY], STATS_CELL_SIZE, values.p50_latency_ns);
+        print_scaled_latency(row->cells[COLUMN_P99_LATENCY], STATS_CELL_SIZE, values.p99_latency_ns);
+        print_scaled_latency(row->cells[COLUMN_P999_LATENCY], STATS_CELL_SIZE, values.p999_latency_ns);
+    } else {
+        for (int i = COLUMN_MIN_LATENCY; i <= COLUMN_P999_LATENCY; i++) {
+            snprintf(row->cells[i], STATS_CELL_SIZE, "null");
+        }
+    }
+
+    if (values.preempts_count > 0) {
+        snprintf(row->cells[COLUMN_MIN_PREEMPTS], STATS_CELL_SIZE, "%lu", values.min_preempts);
+        snprintf(row->cells[COLUMN_MAX_PREEMPTS], STATS_CELL_SIZE, "%lu", values.max_preempts);
+        snprintf(row->cells[COLUMN_AVG_PREEMPTS], STATS_CELL_SIZE, "%lu",
+                 values.total_preempts / values.preempts_count);
+    } else {
+        for (int i = COLUMN_MIN_PREEMPTS; i <= COLUMN_AVG_PREEMPTS; i++) {
+            snprintf(row->cells[i], STATS_CELL_SIZE, "null");
+        }
+    }
+
+    for (int i = 0; i < COLUMNS_COUNT; i++) {
+        if (i == COLUMN_NAME) {
+            row->widths[i] = get_name_indent(cgroup) + MeasureText(cgroup->short_name, STATS_DATA_FONT_SIZE);
         } else {
-            temp_snprintf("null");
-            min_latency_column_width = MAX(min_latency_column_width, MeasureText(buffer, STATS_DATA_FONT_SIZE));
-            max_latency_column_width = MAX(max_latency_column_width, MeasureText(buffer, STATS_DATA_FONT_SIZE));
-            avg_latency_column_width = MAX(avg_latency_column_width, MeasureText(buffer, STATS_DATA_FONT_SIZE));
+            row->widths[i] = MeasureText(row->cells[i], STATS_DATA_FONT_SIZE);
         }
+    }
+}
 
-        if (cgroup.preempts_count > 0) {
-            temp_snprintf("%u", cgroup.min_preempts);
-            min_preempts_column_width = MAX(min_preempts_column_width, MeasureText(buffer, STATS_DATA_FONT_SIZE));
+// Column widths are remeasured only when a row or the set of enabled cgroups changes
+static void update_stats_layout(CgroupVec cgroups) {
+    while (stats_rows.length < cgroups.length) VECTOR_PUSH(&stats_rows, (StatsRow) {0});
 
-            temp_snprintf("%u", cgroup.max_preempts);
-            max_preempts_column_width = MAX(max_preempts_column_width, MeasureText(buffer, STATS_DATA_FONT_SIZE));
+    for (int k = 0; k < shown_cgroups.length; k++) {
+        int i = shown_cgroups.data[k];
+        const Cgroup *cgroup = &cgroups.data[i];
+        if (!cgroup->is_enabled) continue;
 
-            temp_snprintf("%lu", cgroup.total_preempts / cgroup.preempts_count);
-            avg_preempts_column_width = MAX(avg_preempts_column_width, MeasureText(buffer, STATS_DATA_FONT_SIZE));
-        } else {
-            temp_snprintf("null");
-            min_preempts_column_width = MAX(min_preempts_column_width, MeasureText(buffer, STATS_DATA_FONT_SIZE));
-            max_preempts_column_width = MAX(max_preempts_column_width, MeasureText(buffer, STATS_DATA_FONT_SIZE));
-            avg_preempts_column_width = MAX(avg_preempts_column_width, MeasureText(buffer, STATS_DATA_FONT_SIZE));
+        StatsRow *row = &stats_rows.data[i];
+        StatsValues values = get_stats_values(cgroup);
+        if (!row->is_formatted || memcmp(&row->values, &values, sizeof(values)) != 0) {
+            format_stats_row(row, cgroup, values);
+            is_stats_layout_valid = false;
+        }
+    }
+    if (is_stats_layout_valid) return;
+    is_stats_layout_valid = true;
+
+    stats_label_height = MeasureText2(COLUMN_LABELS[0], STATS_LABEL_FONT_SIZE).y;
+    stats_row_height = MeasureText2(COLUMN_LABELS[0], STATS_DATA_FONT_SIZE).y;
+    for (int i = 0; i < COLUMNS_COUNT; i++) {
+        stats_column_widths[i] = MeasureText(COLUMN_LABELS[i], STATS_LABEL_FONT_SIZE);
+    }
+    for (int k = 0; k < shown_cgroups.length; k++) {
+        int i = shown_cgroups.data[k];
+        if (!cgroups.data[i].is_enabled) continue;
+        for (int j = 0; j < COLUMNS_COUNT; j++) {
+            stats_column_widths[j] = MAX(stats_column_widths[j], stats_rows.data[i].widths[j]);
         }
     }
+}
+
+// Clicking the name of a cgroup with children expands or collapses it
+static void draw_stats_name(Cgroup *cgroup, int x, int y) {
+    int indent = get_name_indent(cgroup);
+    if (cgroup->has_children) {
+        DrawText(cgroup->is_expanded ? "-" : "+", x + indent - STATS_INDENT_WIDTH, y, STATS_DATA_FONT_SIZE, FOREGROUND);
 
-    int id_column_x = HOR_PADDING;
-    int name_column_x = id_column_x + id_column_width + STATS_COLUMN_PADDING;
-    int min_latency_column_x = name_column_x + name_column_width + STATS_COLUMN_PADDING;
-    int max_latency_column_x = min_latency_column_x + min_latency_column_width + STATS_COLUMN_PADDING;
-    int avg_latency_column_x = max_latency_column_x + max_latency_column_width + STATS_COLUMN_PADDING;
-    int min_preempts_column_x = avg_latency_column_x + avg_latency_column_width + STATS_COLUMN_PADDING;
-    int max_preempts_column_x = min_preempts_column_x + min_preempts_column_width + STATS_COLUMN_PADDING;
-    int avg_preempts_column_x = max_preempts_column_x + max_preempts_column_width + STATS_COLUMN_PADDING;
+        Rectangle rec = {
+            .x = x,
+            .y = y,
+            .width = indent + MeasureText(cgroup->short_name, STATS_DATA_FONT_SIZE),
+            .height = stats_row_height,
+        };
+        if (CheckCollisionPointRec(GetMousePosition(), rec)) {
+            SetMouseCursor(MOUSE_CURSOR_POINTING_HAND);
+            if (IsMouseButtonPressed(MOUSE_BUTTON_LEFT)) {
+                cgroup->is_expanded = !cgroup->is_expanded;
+                is_stats_layout_valid = false;
+                is_ranking_valid = false;
+            }
+        }
+    }
+    DrawText(cgroup->short_name, x + indent, y, STATS_DATA_FONT_SIZE, FOREGROUND);
+}
+
+static void draw_stats(int start_y, CgroupVec cgroups) {
+    update_stats_layout(cgroups);
 
     int y = start_y;
-    DrawText("Id", id_column_x, y, STATS_LABEL_FONT_SIZE, FOREGROUND);
-    DrawText("Name", name_column_x, y, STATS_LABEL_FONT_SIZE, FOREGROUND);
-    DrawText("Min latency", min_latency_column_x, y, STATS_LABEL_FONT_SIZE, FOREGROUND);
-    DrawText("Max latency", max_latency_column_x, y, STATS_LABEL_FONT_SIZE, FOREGROUND);
-    DrawText("Avg latency", avg_latency_column_x, y, STATS_LABEL_FONT_SIZE, FOREGROUND);
-    DrawText("Min preempts", min_preempts_column_x, y, STATS_LABEL_FONT_SIZE, FOREGROUND);
-    DrawText("Max preempts", max_preempts_column_x, y, STATS_LABEL_FONT_SIZE, FOREGROUND);
-    DrawText("Avg preempts", avg_preempts_column_x, y, STATS_LABEL_FONT_SIZE, FOREGROUND);
-    y += id_column_dim.y + TEXT_MARGIN;
+    int x = HOR_PADDING;
+    for (int i = 0; i < COLUMNS_COUNT; i++) {
+        DrawText(COLUMN_LABELS[i], x, y, STATS_LABEL_FONT_SIZE, FOREGROUND);
+        x += stats_column_widths[i] + STATS_COLUMN_PADDING;
+    }
+    y += stats_label_height + TEXT_MARGIN;
 
-    for (int i = 0; i < cgroups.length; i++) {
-        Cgroup cgroup = cgroups.data[i];
-        if (!cgroup.is_enabled) continue;
+    int enabled_rows = 0;
+    for (int i = 0; i < shown_cgroups.length; i++) enabled_rows += cgroups.data[shown_cgroups.data[i]].is_enabled;
+    int visible_rows = MAX((height - y) / (stats_row_height + TEXT_MARGIN), 1);
+    stats_scroll = MIN(stats_scroll, enabled_rows - visible_rows);
+    stats_scroll = MAX(stats_scroll, 0);
 
-        if (!cgroup.is_systemd) {
-            temp_snprintf("%lu", cgroup.id);
-        } else {
-            temp_snprintf("null");
+    int row_idx = 0;
+    for (int k = 0; k < shown_cgroups.length && y < height; k++) {
+        int i = shown_cgroups.data[k];
+        Cgroup *cgroup = &cgroups.data[i];
+        if (!cgroup->is_enabled || row_idx++ < stats_scroll) continue;
+
+        const StatsRow *row = &stats_rows.data[i];
+        x = HOR_PADDING;
+        for (int j = 0; j < COLUMNS_COUNT; j++) {
+            if (j == COLUMN_NAME) {
+                draw_stats_name(cgroup, x, y);
+            } else {
+                Color color = j == COLUMN_ID ? COLORS[cgroup->color_idx] : FOREGROUND;
+                DrawText(row->cells[j], x, y, STATS_DATA_FONT_SIZE, color);
+            }
+            x += stats_column_widths[j] + STATS_COLUMN_PADDING;
         }
-        Vector2 td = MeasureText2(buffer, STATS_DATA_FONT_SIZE);
-        DrawText(buffer, id_column_x, y, STATS_DATA_FONT_SIZE, cgroup.color);
+        y += stats_row_height + TEXT_MARGIN;
+    }
+}
 
-        temp_snprintf("%s", get_cgroup_name(cgroup_names, cgroup.id));
-        DrawText(buffer, name_column_x, y, STATS_DATA_FONT_SIZE, FOREGROUND);
+static void resize_heatmap(int cpus) {
+    Color *pixels = malloc((size_t) HEATMAP_COLUMNS * cpus * sizeof(*pixels));
+    heatmap_column_pixels = realloc(heatmap_column_pixels, cpus * sizeof(*heatmap_column_pixels));
+    heatmap_latencies = realloc(heatmap_latencies, cpus * sizeof(*heatmap_latencies));
+    if (pixels == NULL || heatmap_column_pixels == NULL || heatmap_latencies == NULL) ERROR("out of memory.");
+
+    // Rows are appended, so the existing ones stay in place
+    for (int i = 0; i < HEATMAP_COLUMNS * cpus; i++) pixels[i] = BACKGROUND;
+    if (heatmap_cpus > 0) {
+        memcpy(pixels, heatmap_pixels, (size_t) HEATMAP_COLUMNS * heatmap_cpus * sizeof(*pixels));
+        UnloadTexture(heatmap_texture);
+    }
+    free(heatmap_pixels);
+    heatmap_pixels = pixels;
+    heatmap_cpus = cpus;
+
+    Image image = {
+        .data = heatmap_pixels,
+        .width = HEATMAP_COLUMNS,
+        .height = heatmap_cpus,
+        .mipmaps = 1,
+        .format = PIXELFORMAT_UNCOMPRESSED_R8G8B8A8,
+    };
+    heatmap_texture = LoadTextureFromImage(image);
+}
 
-        if (cgroup.latency_count > 0) {
-            temp_print_scaled_latency(cgroup.min_latency_ns);
-            DrawText(buffer, min_latency_column_x, y, STATS_DATA_FONT_SIZE, FOREGROUND);
+// Blue for low latencies through red for high ones
+static Color get_heatmap_color(CpuLatency latency) {
+    if (latency.count == 0) return BACKGROUND;
 
-            temp_print_scaled_latency(cgroup.max_latency_ns);
-            DrawText(buffer, max_latency_column_x, y, STATS_DATA_FONT_SIZE, FOREGROUND);
+    double avg_latency_ns = latency.total_latency_ns / ((double) latency.count);
+    float t = log(avg_latency_ns / HEATMAP_MIN_LATENCY_NS) / log(HEATMAP_MAX_LATENCY_NS / HEATMAP_MIN_LATENCY_NS);
+    t = MIN(MAX(t, 0.0f), 1.0f);
+    return ColorFromHSV(240.0f * (1.0f - t), 0.85f, 0.35f + 0.65f * t);
+}
 
-            temp_print_scaled_latency(cgroup.total_latency_ns / cgroup.latency_count);
-            DrawText(buffer, avg_latency_column_x, y, STATS_DATA_FONT_SIZE, FOREGROUND);
-        } else {
-            temp_snprintf("null");
-            DrawText(buffer, min_latency_column_x, y, STATS_DATA_FONT_SIZE, FOREGROUND);
-            DrawText(buffer, max_latency_column_x, y, STATS_DATA_FONT_SIZE, FOREGROUND);
-            DrawText(buffer, avg_latency_column_x, y, STATS_DATA_FONT_SIZE, FOREGROUND);
+// Writes a column of latencies of the enabled cgroups since the previous sync, the rest of the texture isn't touched
+static void update_heatmap(const Graph *graph) {
+    bool has_data = false;
+    for (int i = 0; i < graph->cgroups.length; i++) has_data |= graph->cgroups.data[i].cpu_latencies.length > 0;
+    if (!has_data) return;
+
+    if (graph->cpus_count > heatmap_cpus) resize_heatmap(graph->cpus_count);
+
+    memset(heatmap_latencies, 0, heatmap_cpus * sizeof(*heatmap_latencies));
+    for (int i = 0; i < graph->cgroups.length; i++) {
+        const Cgroup *cgroup = &graph->cgroups.data[i];
+        if (!cgroup->is_enabled) continue;
+
+        for (int cpu = 0; cpu < cgroup->cpu_latencies.length; cpu++) {
+            heatmap_latencies[cpu].total_latency_ns += cgroup->cpu_latencies.data[cpu].total_latency_ns;
+            heatmap_latencies[cpu].count += cgroup->cpu_latencies.data[cpu].count;
+        }
+    }
+
+    for (int cpu = 0; cpu < heatmap_cpus; cpu++) {
+        Color color = get_heatmap_color(heatmap_latencies[cpu]);
+        heatmap_column_pixels[cpu] = color;
+        heatmap_pixels[cpu * HEATMAP_COLUMNS + heatmap_column] = color;
+    }
+    UpdateTextureRec(heatmap_texture, (Rectangle) {heatmap_column, 0, 1, heatmap_cpus}, heatmap_column_pixels);
+    heatmap_column = (heatmap_column + 1) % HEATMAP_COLUMNS;
+}
+
+// Ring is drawn oldest first in at most two draw calls, regardless of the number of CPUs
+static void draw_cpu_heatmap(int start_y) {
+    const char *label = "Runqueue latency per CPU (1us - 100ms, log scale)";
+    DrawText(label, HOR_PADDING, start_y, STATS_LABEL_FONT_SIZE, FOREGROUND);
+    int y = start_y + MeasureText2(label, STATS_LABEL_FONT_SIZE).y + TEXT_MARGIN;
+    if (heatmap_cpus == 0) return;
+
+    Rectangle area = {HOR_PADDING, y, graph_width, height - y - TEXT_MARGIN};
+    float px_per_column = area.width / HEATMAP_COLUMNS;
+    int oldest_columns = HEATMAP_COLUMNS - heatmap_column;
+
+    Rectangle src = {heatmap_column, 0, oldest_columns, heatmap_cpus};
+    Rectangle dst = {area.x, area.y, oldest_columns * px_per_column, area.height};
+    DrawTexturePro(heatmap_texture, src, dst, (Vector2) {0, 0}, 0.0f, WHITE);
+    if (heatmap_column > 0) {
+        src = (Rectangle) {0, 0, heatmap_column, heatmap_cpus};
+        dst = (Rectangle) {area.x + dst.width, area.y, heatmap_column * px_per_column, area.height};
+        DrawTexturePro(heatmap_texture, src, dst, (Vector2) {0, 0}, 0.0f, WHITE);
+    }
+
+    DrawText("0", HOR_PADDING - MeasureText("0", AXIS_DATA_FONT_SIZE) - TEXT_MARGIN, area.y, AXIS_DATA_FONT_SIZE,
+             FOREGROUND);
+    temp_snprintf("%d", heatmap_cpus - 1);
+    DrawText(buffer, HOR_PADDING - MeasureText(buffer, AXIS_DATA_FONT_SIZE) - TEXT_MARGIN,
+             area.y + area.height - AXIS_DATA_FONT_SIZE, AXIS_DATA_FONT_SIZE, FOREGROUND);
+}
+
+static void free_heatmap(void) {
+    if (heatmap_cpus > 0) UnloadTexture(heatmap_texture);
+    free(heatmap_pixels);
+    free(heatmap_column_pixels);
+    free(heatmap_latencies);
+}
+
+typedef struct {
+    int cgroup_idx;
+    uint64_t caused;    // preemptions of other cgroups' tasks
+    uint64_t suffered;  // by other cgroups' tasks
+} PreemptionTotals;
+
+VECTOR_TYPEDEF(PreemptionTotalsVec, PreemptionTotals);
+
+static PreemptionTotalsVec preemption_totals = {0};
+static IntVec matrix_positions = {0};  // cgroup -> row and column of the matrix, -1 if it isn't in it
+
+static bool is_pair_enabled(CgroupVec cgroups, PreemptionPair pair) {
+    return cgroups.data[pair.victim_idx].is_enabled && cgroups.data[pair.aggressor_idx].is_enabled;
+}
+
+static int compare_caused(const void *a, const void *b) {
+    uint64_t a_caused = ((const PreemptionTotals *) a)->caused;
+    uint64_t b_caused = ((const PreemptionTotals *) b)->caused;
+    return (a_caused < b_caused) - (a_caused > b_caused);
+}
+
+static int compare_involvement(const void *a, const void *b) {
+    const PreemptionTotals *a_totals = a;
+    const PreemptionTotals *b_totals = b;
+    uint64_t a_involvement = a_totals->caused + a_totals->suffered;
+    uint64_t b_involvement = b_totals->caused + b_totals->suffered;
+    return (a_involvement < b_involvement) - (a_involvement > b_involvement);
+}
+
+// Rows are victims and columns are aggressors, labeled by their colors. Returns the right edge.
+static int draw_preemptions_matrix(int start_y, CgroupVec cgroups, PreemptionPairVec pairs) {
+    qsort(preemption_totals.data, preemption_totals.length, sizeof(*preemption_totals.data), compare_involvement);
+
+    while (matrix_positions.length < cgroups.length) VECTOR_PUSH(&matrix_positions, -1);
+    for (int i = 0; i < cgroups.length; i++) matrix_positions.data[i] = -1;
+
+    int matrix_cgroups[PREEMPTIONS_MATRIX_SIZE];
+    int size = 0;
+    for (int i = 0; i < preemption_totals.length && size < PREEMPTIONS_MATRIX_SIZE; i++) {
+        PreemptionTotals totals = preemption_totals.data[i];
+        if (totals.caused + totals.suffered == 0) break;
+
+        matrix_positions.data[totals.cgroup_idx] = size;
+        matrix_cgroups[size++] = totals.cgroup_idx;
+    }
+
+    // Preemptions within a cgroup are on the diagonal
+    uint64_t matrix[PREEMPTIONS_MATRIX_SIZE][PREEMPTIONS_MATRIX_SIZE] = {0};
+    uint64_t max_count = 0;
+    for (int i = 0; i < pairs.length; i++) {
+        PreemptionPair pair = pairs.data[i];
+        int row = matrix_positions.data[pair.victim_idx];
+        int column = matrix_positions.data[pair.aggressor_idx];
+        if (row == -1 || column == -1 || !is_pair_enabled(cgroups, pair)) continue;
+
+        matrix[row][column] += pair.count;
+        max_count = MAX(max_count, matrix[row][column]);
+    }
+
+    const char *label = "Preemptions of rows by columns";
+    int y = start_y + MeasureText2(label, STATS_LABEL_FONT_SIZE).y + TEXT_MARGIN;
+    int cell_size = MAX(MIN((height - y - TEXT_MARGIN) / (PREEMPTIONS_MATRIX_SIZE + 1), PREEMPTIONS_MAX_CELL_SIZE), 1);
+    int x = HOR_PADDING;
+
+    // Hovered cell replaces the label with its count
+    char hover_text[BUFFER_SIZE];
+    Vector2 mouse = GetMousePosition();
+    int hover_row = (mouse.y - y) / cell_size - 1;
+    int hover_column = (mouse.x - x) / cell_size - 1;
+    if (mouse.x >= x && mouse.y >= y && hover_row >= 0 && hover_row < size && hover_column >= 0
+        && hover_column < size) {
+        snprintf(hover_text, sizeof(hover_text), "%s by %s: %lu", cgroups.data[matrix_cgroups[hover_row]].name,
+                 cgroups.data[matrix_cgroups[hover_column]].name, matrix[hover_row][hover_column]);
+        label = hover_text;
+    }
+    DrawText(label, x, start_y, STATS_LABEL_FONT_SIZE, FOREGROUND);
+
+    for (int i = 0; i < size; i++) {
+        Color color = COLORS[cgroups.data[matrix_cgroups[i]].color_idx];
+        DrawRectangle(x + (i + 1) * cell_size + 1, y + 1, cell_size - 2, cell_size - 2, color);
+        DrawRectangle(x + 1, y + (i + 1) * cell_size + 1, cell_size - 2, cell_size - 2, color);
+    }
+
+    // Log scale, so that a few aggressive pairs don't hide the rest
+    for (int row = 0; row < size; row++) {
+        for (int column = 0; column < size; column++) {
+            uint64_t count = matrix[row][column];
+            Color color = GRID_COLOR;
+            if (count > 0) {
+                float t = log1p(count) / log1p(max_count);
+                color = ColorFromHSV(0.0f, 0.85f, 0.25f + 0.75f * t);
+            }
+            DrawRectangle(x + (column + 1) * cell_size + 1, y + (row + 1) * cell_size + 1, cell_size - 2,
+                          cell_size - 2, color);
         }
+    }
+
+    return x + MAX((size + 1) * cell_size, MeasureText(label, STATS_LABEL_FONT_SIZE));
+}
 
-        if (cgroup.preempts_count > 0) {
-            temp_snprintf("%u", cgroup.min_preempts);
-            DrawText(buffer, min_preempts_column_x, y, STATS_DATA_FONT_SIZE, FOREGROUND);
+// Both the matrix and the ranking are of the enabled cgroups since the start
+static void draw_preemptions(int start_y, const Graph *graph) {
+    CgroupVec cgroups = graph->cgroups;
+    PreemptionPairVec pairs = graph->preemption_pairs;
+
+    preemption_totals.length = 0;
+    for (int i = 0; i < cgroups.length; i++) VECTOR_PUSH(&preemption_totals, ((PreemptionTotals) {.cgroup_idx = i}));
+    for (int i = 0; i < pairs.length; i++) {
+        PreemptionPair pair = pairs.data[i];
+        if (pair.victim_idx == pair.aggressor_idx || !is_pair_enabled(cgroups, pair)) continue;
+
+        preemption_totals.data[pair.aggressor_idx].caused += pair.count;
+        preemption_totals.data[pair.victim_idx].suffered += pair.count;
+    }
 
-            temp_snprintf("%u", cgroup.max_preempts);
-            DrawText(buffer, max_preempts_column_x, y, STATS_DATA_FONT_SIZE, FOREGROUND);
+    int x = draw_preemptions_matrix(start_y, cgroups, pairs) + 2 * STATS_COLUMN_PADDING;
 
-            temp_snprintf("%lu", cgroup.total_preempts / cgroup.preempts_count);
-            DrawText(buffer, avg_preempts_column_x, y, STATS_DATA_FONT_SIZE, FOREGROUND);
+    const char *label = "Top aggressors (preemptions of other cgroups)";
+    DrawText(label, x, start_y, STATS_LABEL_FONT_SIZE, FOREGROUND);
+    int y = start_y + MeasureText2(label, STATS_LABEL_FONT_SIZE).y + TEXT_MARGIN;
+    int row_height = MeasureText2(label, STATS_DATA_FONT_SIZE).y + TEXT_MARGIN;
+
+    qsort(preemption_totals.data, preemption_totals.length, sizeof(*preemption_totals.data), compare_caused);
+    for (int i = 0; i < preemption_totals.length && y + row_height <= height; i++, y += row_height) {
+        PreemptionTotals totals = preemption_totals.data[i];
+        if (totals.caused == 0) break;
+
+        const Cgroup *cgroup = &cgroups.data[totals.cgroup_idx];
+        temp_snprintf("%lu", totals.caused);
+        DrawText(buffer, x, y, STATS_DATA_FONT_SIZE, FOREGROUND);
+        DrawText(cgroup->name, x + PREEMPTIONS_COUNT_WIDTH, y, STATS_DATA_FONT_SIZE, COLORS[cgroup->color_idx]);
+    }
+}
+
+// Overhead of each program is relative to a single CPU, drops are listed only for the reasons which occurred
+static void format_probe_stats(char *dst, int size, const ProbeStats *prev, const ProbeStats *stats,
+                               double interval_s) {
+    int length = 0;
+    for (int i = 0; i < PROBE_PROGRAMS && length < size; i++) {
+        uint64_t run_time_ns = stats->programs[i].run_time_ns - prev->programs[i].run_time_ns;
+        uint64_t run_count = stats->programs[i].run_count - prev->programs[i].run_count;
+        if (stats->programs[i].run_count == 0) {
+            length += snprintf(dst + length, size - length, "\n%s: no BPF stats", stats->programs[i].name);
         } else {
-            temp_snprintf("null");
-            DrawText(buffer, min_preempts_column_x, y, STATS_DATA_FONT_SIZE, FOREGROUND);
-            DrawText(buffer, max_preempts_column_x, y, STATS_DATA_FONT_SIZE, FOREGROUND);
-            DrawText(buffer, avg_preempts_column_x, y, STATS_DATA_FONT_SIZE, FOREGROUND);
+            length += snprintf(dst + length, size - length, "\n%s: %.2f%% CPU, %luns/run", stats->programs[i].name,
+                               run_time_ns / (interval_s * NS_IN_S) * 100, run_count > 0 ? run_time_ns / run_count : 0);
         }
+    }
 
-        y += td.y + TEXT_MARGIN;
-        if (y >= height) break;
+    uint64_t total_drops = 0;
+    for (int i = 0; i < DROP_REASONS; i++) total_drops += stats->drops[i];
+    if (length < size) length += snprintf(dst + length, size - length, "\n%lu dropped", total_drops);
+    for (int i = 0; i < DROP_REASONS && length < size; i++) {
+        uint64_t drops = stats->drops[i] - prev->drops[i];
+        if (drops == 0) continue;
+        length += snprintf(dst + length, size - length, "\n%s: %.0f/s", DROP_REASON_NAMES[i], drops / interval_s);
+    }
+
+    uint64_t wakeups = stats->wakeups - prev->wakeups;
+    uint64_t delivered_events = stats->delivered_events - prev->delivered_events;
+    uint64_t delivery_ns = stats->total_delivery_ns - prev->total_delivery_ns;
+    if (length < size) {
+        snprintf(dst + length, size - length, "\n%.0f wakeups/s, %.2fms delivery", wakeups / interval_s,
+                 delivered_events > 0 ? delivery_ns / (double) delivered_events / NS_IN_MS : 0);
     }
 }
 
 static void draw_performance_info(bool is_ebpf_running) {
+    static ProbeStats prev_probe_stats;
+    static double prev_probe_stats_time = -1;
+    static char probe_text[BUFFER_SIZE] = "";
+
+    // Rates are of the last interval, so the text only changes once per interval
+    ProbeStats probe_stats;
+    double now = GetTime();
+    if (now - prev_probe_stats_time >= PROBE_STATS_INTERVAL_S && get_probe_stats(&probe_stats)) {
+        if (prev_probe_stats_time >= 0) {
+            format_probe_stats(probe_text, sizeof(probe_text), &prev_probe_stats, &probe_stats,
+                               now - prev_probe_stats_time);
+        }
+        prev_probe_stats = probe_stats;
+        prev_probe_stats_time = now;
+    }
+
     int fps = GetFPS();
     time_t t = time(NULL);
     struct tm *tm = localtime(&t);
@@ -880,30 +1229,213 @@ static void draw_performance_info(bool is_ebpf_running) {
     uint32_t time_diff = time_s - max_time_s;
     if (!is_ebpf_running) time_diff = 0;
 
-    char buffer[32];
-    snprintf(buffer, 32, "%dfps\n%us behind", fps, time_diff);
+    char buffer[BUFFER_SIZE + 32];
+    snprintf(buffer, sizeof(buffer), "%dfps\n%us behind%s", fps, time_diff, probe_text);
 
     Vector2 td = MeasureText2(buffer, STATS_DATA_FONT_SIZE);
     DrawText(buffer, width - td.x - TEXT_MARGIN, height - td.y - TEXT_MARGIN, STATS_DATA_FONT_SIZE, FOREGROUND);
 }
 
-int main(void) {
+static volatile sig_atomic_t is_interrupted = 0;
+
+static void interrupt_handler(int signal) {
+    (void) signal;
+    is_interrupted = 1;
+}
+
+// Headless mode: keeps the ingestion going and serves its counters until interrupted
+static void run_exporter(const char *address) {
+    start_exporter(address);
+
+    struct sigaction action = {.sa_handler = interrupt_handler};
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    // Counters are cumulative, so the series are kept as short as possible
+    Graph graph = {.max_points = MIN_RETENTION_POINTS};
+    ProbeStats probe_stats;
+    while (!is_interrupted) {
+        sync_ingestion(&graph);
+        bool has_probe_stats = get_probe_stats(&probe_stats);
+        serve_exporter(&graph, has_probe_stats ? &probe_stats : NULL, 100);
+    }
+
+    free_graph(&graph);
+    close_exporter();
+}
+
+// Headless mode: keeps the ingestion going and streams what it aggregated to a viewer once per window
+static void run_agent(const char *address, uint64_t window_ns) {
+    start_stream_agent(address, window_ns);
+
+    struct sigaction action = {.sa_handler = interrupt_handler};
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    // Only the cumulative counters are sent, as in the exporter
+    Graph graph = {.max_points = MIN_RETENTION_POINTS};
+    bool is_running = true;
+    while (!is_interrupted && is_running) {
+        wait_stream_window();
+        is_running = sync_ingestion(&graph);
+        send_stream(&graph);
+    }
+
+    free_graph(&graph);
+    close_stream_agent();
+}
+
+// Parses "cgroup[:ratio]" where cgroup is a path relative to the cgroup2 mount or an id
+static void add_cgroup_rule(CgroupFilter *filter, char *arg, bool is_excluded) {
+    CgroupRule rule = {.sample_ratio = is_excluded ? 0 : 1};
+
+    char *ratio = strrchr(arg, ':');
+    if (ratio != NULL && !is_excluded) {
+        *ratio++ = '\0';
+        char *end;
+        long value = strtol(ratio, &end, 10);
+        if (*ratio == '\0' || *end != '\0' || value < 1 || value > UINT32_MAX) {
+            ERROR("sampling ratio must be a positive integer.");
+        }
+        rule.sample_ratio = value;
+    }
+
+    if (!find_cgroup_id(arg, &rule.cgroup_id)) {
+        char *end;
+        rule.cgroup_id = strtoull(arg, &end, 10);
+        if (*arg == '\0' || *end != '\0') ERROR("unable to find cgroup \"%s\".", arg);
+    }
+    VECTOR_PUSH(&filter->rules, rule);
+}
+
+static void usage(const char *program) {
+    fprintf(stderr, "Usage: %s [-a] [-m points] [-e [host:]port] [-i cgroup[:n]]... [-x cgroup]...\n", program);
+    fprintf(stderr, "          [-b bytes] [-t ms] [-w file | -r file [-s speed]] [-c address | -l address]\n");
+    fprintf(stderr, "          [-k count]\n");
+    fprintf(stderr, "  -a         aggregate stats in the kernel instead of sending every event\n");
+    fprintf(stderr, "  -m points  max number of points per series, older ones are compacted (default: %d)\n",
+            DEFAULT_RETENTION_POINTS);
+    fprintf(stderr, "  -e address serve Prometheus metrics on /metrics without the window (host: localhost)\n");
+    fprintf(stderr, "  -i cgroup  trace only the subtrees of these cgroups, with \":n\" 1 in n of their wakeups\n");
+    fprintf(stderr, "  -x cgroup  don't trace the subtree of the cgroup, cgroups are paths in /sys/fs/cgroup or ids\n");
+    fprintf(stderr, "  -b bytes   wake up the reader once this many bytes of events are pending, 0 for each one\n");
+    fprintf(stderr, "             (default: %d)\n", DEFAULT_WAKEUP_WATERMARK);
+    fprintf(stderr, "  -t ms      wake up the reader at least this often while events arrive (default: %llu)\n",
+            DEFAULT_WAKEUP_DEADLINE_NS / NS_IN_MS);
+    fprintf(stderr, "  -w file    record events into a capture file\n");
+    fprintf(stderr, "  -r file    replay a capture file instead of running eBPF, doesn't require root\n");
+    fprintf(stderr, "  -s speed   replay speed relative to the capture, 0 is as fast as possible (default: 1)\n");
+    fprintf(stderr, "  -c address run without the window, streaming to a viewer at [host:]port or unix:path\n");
+    fprintf(stderr, "  -l address merge streams of agents instead of running eBPF, doesn't require root\n");
+    fprintf(stderr, "  -k count   number of the worst cgroups shown once T ranks them (default: %d)\n",
+            DEFAULT_TOP_CGROUPS);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv) {
+    IngestOptions options = {
+        .replay_speed = 1,
+        .wakeup = {.watermark = DEFAULT_WAKEUP_WATERMARK, .deadline_ns = DEFAULT_WAKEUP_DEADLINE_NS},
+    };
+    int max_points = DEFAULT_RETENTION_POINTS;
+    const char *exporter_address = NULL;
+    const char *agent_address = NULL;
+    CgroupFilter cgroup_filter = {.default_sample_ratio = 1};
+
+    int opt;
+    while ((opt = getopt(argc, argv, "am:e:i:x:b:t:w:r:s:c:l:k:")) != -1) {
+        switch (opt) {
+            case 'a':
+                options.aggregate_in_kernel = true;
+                break;
+            case 'm':
+                max_points = atoi(optarg);
+                if (max_points < MIN_RETENTION_POINTS) {
+                    ERROR("max number of points must be at least %d.", MIN_RETENTION_POINTS);
+                }
+                break;
+            case 'e':
+                exporter_address = optarg;
+                break;
+            case 'i':
+                add_cgroup_rule(&cgroup_filter, optarg, false);
+                // Cgroups outside of the included subtrees aren't traced
+                cgroup_filter.default_sample_ratio = 0;
+                break;
+            case 'x':
+                add_cgroup_rule(&cgroup_filter, optarg, true);
+                break;
+            case 'b':
+                if (atol(optarg) < 0) ERROR("wakeup watermark must not be negative.");
+                options.wakeup.watermark = atol(optarg);
+                break;
+            case 't':
+                if (atol(optarg) <= 0) ERROR("wakeup deadline must be positive.");
+                options.wakeup.deadline_ns = atol(optarg) * NS_IN_MS;
+                break;
+            case 'w':
+                options.record_path = optarg;
+                break;
+            case 'r':
+                options.replay_path = optarg;
+                break;
+            case 's':
+                options.replay_speed = atof(optarg);
+                if (options.replay_speed < 0) ERROR("replay speed must not be negative.");
+                break;
+            case 'c':
+                agent_address = optarg;
+                break;
+            case 'l':
+                options.listen_address = optarg;
+                break;
+            case 'k':
+                top_cgroups = atoi(optarg);
+                if (top_cgroups <= 0) ERROR("number of top cgroups must be positive.");
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+    if (optind != argc) usage(argv[0]);
+    if (options.record_path != NULL && options.replay_path != NULL) usage(argv[0]);
+    if (options.aggregate_in_kernel && (options.record_path != NULL || options.replay_path != NULL)) {
+        ERROR("captures contain every event, they can't be used with aggregation in the kernel.");
+    }
+    if (agent_address != NULL && (exporter_address != NULL || options.listen_address != NULL)) usage(argv[0]);
+    bool is_viewer = options.listen_address != NULL;
+    if (is_viewer && (options.aggregate_in_kernel || options.record_path != NULL || options.replay_path != NULL)) {
+        ERROR("viewer only merges the agents' streams, eBPF options are given to the agents.");
+    }
+    bool is_replay = options.replay_path != NULL;
+    if (cgroup_filter.rules.length > 0) {
+        if (is_replay) ERROR("cgroups are filtered in the kernel, so they can't be filtered in a replay.");
+        if (is_viewer) ERROR("cgroups are filtered in the kernel, so they are filtered by the agents.");
+        options.cgroup_filter = &cgroup_filter;
+    }
+
     if (RAYLIB_VERSION_MAJOR != 5) ERROR("the required raylib version is 5.");
-    if (geteuid() != 0) ERROR("must be ran as root.");
+    if (!is_replay && !is_viewer && geteuid() != 0) ERROR("must be ran as root.");
 
-    bool is_child_running = true;
-    int input_fd;
-    pid_t child;
-    start_ebpf(&input_fd, &child);
+    start_ingestion(&options);
 
-    CgroupInfoVec cgroup_names = {0};
-    collect_cgroup_names(&cgroup_names);
+    if (agent_address != NULL) {
+        run_agent(agent_address, options.aggregate_in_kernel ? KERNEL_BATCHING_TIME_NS : STREAM_WINDOW_NS);
+        close_ingestion();
+        VECTOR_FREE(&cgroup_filter.rules);
+        return EXIT_SUCCESS;
+    }
 
-    EntryVec entries = {0};
-    CgroupVec cgroups = {0};
+    if (exporter_address != NULL) {
+        run_exporter(exporter_address);
+        close_ingestion();
+        VECTOR_FREE(&cgroup_filter.rules);
+        return EXIT_SUCCESS;
+    }
 
+    bool is_ebpf_running = true;
+    Graph graph = {.max_points = max_points};
     bool is_size_init = false;
-    bool is_min_set = false;
 
     SetTraceLogLevel(LOG_WARNING);
     SetConfigFlags(FLAG_WINDOW_RESIZABLE);
@@ -925,34 +1457,29 @@ int main(void) {
 
         // Data
 
-        if (is_child_running) {
-            if (read_entries(&entries, input_fd) != 0) {
-                int status;
-                waitpid(child, &status, 0);
-                status = WEXITSTATUS(status);
-
-                if (status == 0) {
-                    is_child_running = false;
-                } else if (status == ENOENT) {
-                    ERROR("unable to find \"ecli\" to run eBPF program.");
-                } else {
-                    ERROR("eBPF process exited unexpectedly.");
-                }
-            }
-            if (entries.length == 0) continue;
+        int prev_cgroups_length = graph.cgroups.length;
+        is_ebpf_running = sync_ingestion(&graph);
+        for (int i = prev_cgroups_length; i < graph.cgroups.length; i++) {
+            graph.cgroups.data[i].color_idx = i % COLORS_LEN;
+        }
+        update_visibility(graph.cgroups);
 
-            if (!is_min_set) {
-                is_min_set = true;
-                min_ktime_ns = entries.data[0].ktime_ns;
-                min_time_s = entries.data[0].time_s;
-                // Min latency and preemptions are assumed to be 0
-            }
+        update_heatmap(&graph);
 
-            max_time_s = entries.data[entries.length - 1].time_s;
+        min_time_s = graph.min_time_s;
+        max_time_s = graph.max_time_s;
+        uint64_t prev_min_ktime_ns = min_ktime_ns;
+        uint64_t prev_max_ktime_ns = max_ktime_ns;
+        min_ktime_ns = graph.min_ktime_ns;
+        max_ktime_ns = graph.max_ktime_ns;
+        keep_view_window(prev_min_ktime_ns, prev_max_ktime_ns);
 
-            // Updates max ktime, latency, preempts
-            group_entries(&cgroups, &cgroup_names, &entries);
-        }
+        // Finest granularity which covers the view, the rest of the view is drawn at it too
+        granularity = get_granularity_for(&graph, min_ktime_ns + (max_ktime_ns - min_ktime_ns) * x_offset);
+        // Quantile lines need the points' sketches
+        if (LATENCY_LINES[latency_line].quantile >= 0) granularity = MAX(granularity, FIRST_SKETCH_GRANULARITY);
+        max_latency_ns = graph.max_latency_ns[granularity];
+        max_preempts = graph.max_preempts[granularity];
 
         ktime_per_px = (max_ktime_ns - min_ktime_ns) / ((double) graph_width);
         time_per_px = (max_time_s - min_time_s) / ((double) graph_width);
@@ -965,9 +1492,8 @@ int main(void) {
         if (IsKeyDown(KEY_RIGHT)) x_offset = MIN(x_offset + 1.0f / (x_scale * OFFSET_SPEED), 1.0f - 1.0f / x_scale);
 
         if (IsKeyDown(KEY_EQUAL)) {
-            x_scale = MIN(
-                x_scale * X_SCALE_SPEED,
-                (max_ktime_ns - min_ktime_ns) / ((double) (MIN_NUMBER_OF_POINTS_VISIBLE * CGROUP_BATCHING_TIME_NS)));
+            uint64_t min_visible_ns = MIN_NUMBER_OF_POINTS_VISIBLE * GRANULARITIES[graph.finest_granularity].point_ns;
+            x_scale = MIN(x_scale * X_SCALE_SPEED, (max_ktime_ns - min_ktime_ns) / ((double) min_visible_ns));
         }
         if (IsKeyDown(KEY_MINUS)) {
             x_scale = MAX(x_scale / X_SCALE_SPEED, 1.0f);
@@ -983,13 +1509,26 @@ int main(void) {
             else latency_y_scale = MAX(latency_y_scale / Y_SCALE_SPEED, MIN_Y_SCALE);
         }
 
-        if (IsKeyPressed(KEY_SPACE)) kill(child, SIGTERM);
+        if (IsKeyPressed(KEY_SPACE)) stop_ingestion();
 
         if (IsKeyPressed(KEY_Z)) draw_latency = !draw_latency;
         if (IsKeyPressed(KEY_X)) draw_preempts = !draw_preempts;
 
         if (IsKeyPressed(KEY_F)) bar_graph = !bar_graph;
 
+        if (IsKeyPressed(KEY_P)) latency_line = (latency_line + 1) % LATENCY_LINES_LEN;
+        if (IsKeyPressed(KEY_T)) {
+            rank_metric = (rank_metric + 1) % RANK_METRICS_COUNT;
+            is_ranking_valid = false;
+        }
+
+        if (IsKeyPressed(KEY_H)) bot_panel = bot_panel == PANEL_HEATMAP ? PANEL_STATS : PANEL_HEATMAP;
+        if (IsKeyPressed(KEY_M)) bot_panel = bot_panel == PANEL_PREEMPTIONS ? PANEL_STATS : PANEL_PREEMPTIONS;
+
+        if (GetMousePosition().y > height - bot_padding) stats_scroll -= GetMouseWheelMove() * STATS_SCROLL_SPEED;
+
+        update_view_version();
+
         // Drawing
 
         BeginDrawing();
@@ -999,27 +1538,39 @@ int main(void) {
 
         int x_axis_max_y = draw_x_axis();
         draw_y_axis();
-        draw_legend(cgroups);
-        draw_graph(cgroups);  // collects stats
-        draw_stats(x_axis_max_y, cgroups, &cgroup_names);
-        draw_performance_info(is_child_running);
+        select_shown_cgroups(graph.cgroups);
+        update_stats(graph.cgroups);
+        draw_legend(graph.cgroups);
+        draw_graph(graph.cgroups);
+        switch (bot_panel) {
+            case PANEL_STATS:
+                draw_stats(x_axis_max_y, graph.cgroups);
+                break;
+            case PANEL_HEATMAP:
+                draw_cpu_heatmap(x_axis_max_y);
+                break;
+            case PANEL_PREEMPTIONS:
+                draw_preemptions(x_axis_max_y, &graph);
+                break;
+        }
+        draw_performance_info(is_ebpf_running && !is_replay);
 
         EndDrawing();
     }
 
+    free_heatmap();
     CloseWindow();
 
-    for (int i = 0; i < cgroups.length; i++) {
-        VECTOR_FREE(&cgroups.data[i].latencies);
-        VECTOR_FREE(&cgroups.data[i].preempts);
-    }
-    VECTOR_FREE(&cgroups);
-    VECTOR_FREE(&entries);
-    for (int i = 0; i < cgroup_names.length; i++) free(cgroup_names.data[i].name);
-    VECTOR_FREE(&cgroup_names);
-
-    kill(child, SIGTERM);
-    close(input_fd);
+    free_cgroup_lines();
+    VECTOR_FREE(&stats_rows);
+    VECTOR_FREE(&top_heap);
+    VECTOR_FREE(&shown_cgroups);
+    VECTOR_FREE(&previous_shown_cgroups);
+    VECTOR_FREE(&preemption_totals);
+    VECTOR_FREE(&matrix_positions);
+    free_graph(&graph);
+    close_ingestion();
+    VECTOR_FREE(&cgroup_filter.rules);
 
     return EXIT_SUCCESS;
 }
@@ -0,0 +1,112 @@
+#define _GNU_SOURCE
+#include "parse.h"
+#include <string.h>
+
+static const uint64_t POWERS_OF_10[] = {1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000};
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+
+static const uint64_t ZEROES = 0x3030303030303030ULL;  // '0' in each byte
+static const uint64_t HIGH_BITS = 0x8080808080808080ULL;
+
+// Number of leading digits of the 8 bytes. The first non-digit byte gets its high bit set: it's either above '9' and
+// overflows with 0x46 added, or below '0' and underflows, bytes before it are digits and don't carry or borrow.
+static int count_digits(uint64_t chunk) {
+    uint64_t non_digits = ((chunk + 0x4646464646464646ULL) | (chunk - ZEROES) | chunk) & HIGH_BITS;
+    if (non_digits == 0) return 8;
+    return __builtin_ctzll(non_digits) / 8;
+}
+
+// Decodes the first count digits of the 8 bytes, the first one is in the lowest byte
+static uint64_t decode_digits(uint64_t chunk, int count) {
+    // Shifted out bytes become leading zeroes
+    chunk = (chunk - ZEROES) << (8 * (8 - count));
+    chunk = chunk * 10 + (chunk >> 8);  // pairs of digits in every other byte
+    chunk = (((chunk & 0x000000FF000000FFULL) * (100 + (1000000ULL << 32)))
+             + (((chunk >> 16) & 0x000000FF000000FFULL) * (1 + (10000ULL << 32))))
+            >> 32;
+    return chunk;
+}
+
+// Integers are decoded 8 digits at a time, so reads go up to 7 bytes past the last digit
+static const char *u64_field(uint64_t *ret, const char *ch) {
+    uint64_t value = 0;
+    int count;
+    do {
+        uint64_t chunk;
+        memcpy(&chunk, ch, sizeof(chunk));
+        count = count_digits(chunk);
+        if (count > 0) value = value * POWERS_OF_10[count] + decode_digits(chunk, count);
+        ch += count;
+    } while (count == 8);
+
+    *ret = value;
+    return ch;
+}
+
+#else
+
+static const char *u64_field(uint64_t *ret, const char *ch) {
+    uint64_t value = 0;
+    while ((unsigned char) (*ch - '0') < 10) value = value * 10 + (*ch++ - '0');
+    *ret = value;
+    return ch;
+}
+
+#endif
+
+// Fields are separated by a single space
+static const char *next_field(uint64_t *ret, const char *ch) {
+    assert(*ch == ' ');
+    const char *end = u64_field(ret, ch + 1);
+    assert(end > ch + 1);
+    return end;
+}
+
+static const char *parse_ecli_line(Entry *entry, const char *line) {
+    *entry = (Entry) {.weight = 1};
+
+    // Time of day is derived from ktime, ecli's one wraps at midnight and takes a few divisions to parse
+    const char *ch = line;
+    while (*ch != ' ') ch++;
+
+    // Packages built before the events had a weight print a 0/1 flag, which is the same count
+    uint64_t preempts;
+    ch = next_field(&preempts, ch);
+    ch = next_field(&entry->cgroup_id, ch);
+    ch = next_field(&entry->latency_ns, ch);
+    ch = next_field(&entry->ktime_ns, ch);
+    // Packages built before the events had a CPU and weight don't print them
+    if (*ch != '\n') {
+        uint64_t cpu;
+        ch = next_field(&cpu, ch);
+        assert(cpu <= UINT16_MAX);
+        entry->cpu = cpu;
+    }
+    if (*ch != '\n') {
+        uint64_t weight;
+        ch = next_field(&weight, ch);
+        assert(weight >= 1 && weight <= UINT32_MAX);
+        entry->weight = weight;
+    }
+    assert(*ch == '\n' && preempts <= entry->weight);
+    entry->preempts = preempts;
+
+    return ch + 1;
+}
+
+int parse_ecli_lines(EntryVec *entries, const char *text, int length) {
+    assert(entries != NULL && text != NULL && length >= 0);
+
+    // Lines are parsed up to the last complete one, so they are only scanned for newlines once
+    const char *last_newline = memrchr(text, '\n', length);
+    if (last_newline == NULL) return 0;
+
+    const char *ch = text;
+    while (ch <= last_newline) {
+        Entry entry;
+        ch = parse_ecli_line(&entry, ch);
+        VECTOR_PUSH(entries, entry);
+    }
+    return ch - text;
+}
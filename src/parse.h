@@ -0,0 +1,14 @@
+#ifndef PARSE_H
+#define PARSE_H
+
+#include "ebpf.h"
+
+// Integers are decoded 8 digits at a time, so the text must be followed by this many readable bytes
+#define PARSE_PADDING 8
+
+// Parses the complete lines of ecli's output: "HH:MM:SS preempts cgroup_id latency ktime [cpu weight]\n".
+// Time of day is left 0, it's derived from ktime by the caller.
+// Returns the number of bytes parsed, which is up to the end of the last complete line.
+int parse_ecli_lines(EntryVec *entries, const char *text, int length);
+
+#endif  // PARSE_H
@@ -0,0 +1,10 @@
+#include "probe_stats.h"
+
+const char *const DROP_REASON_NAMES[DROP_REASONS] = {
+    [DROP_RINGBUF_FULL] = "ringbuf_full",
+    [DROP_SAMPLED] = "sampled",
+    [DROP_NO_TASK_STORAGE] = "no_task_storage",
+    [DROP_SAMPLER_MAP_FULL] = "sampler_map_full",
+    [DROP_STATS_MAP_FULL] = "stats_map_full",
+    [DROP_PREEMPTIONS_MAP_FULL] = "preemptions_map_full",
+};
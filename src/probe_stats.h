@@ -0,0 +1,27 @@
+#ifndef PROBE_STATS_H
+#define PROBE_STATS_H
+
+#include <stdint.h>
+#include "latency.h"
+
+#define PROBE_PROGRAMS 2
+
+typedef struct {
+    const char *name;
+    uint64_t run_time_ns;  // only counted while BPF stats are enabled
+    uint64_t run_count;
+} ProgramStats;
+
+// Cumulative since start_ebpf
+typedef struct {
+    uint64_t drops[DROP_REASONS];  // summed over CPUs
+    ProgramStats programs[PROBE_PROGRAMS];
+    // Of the events' ring buffer, counted by userspace
+    uint64_t wakeups;  // reads which were woken up by events
+    uint64_t delivered_events;
+    uint64_t total_delivery_ns;  // from the events to their reads
+} ProbeStats;
+
+extern const char *const DROP_REASON_NAMES[DROP_REASONS];
+
+#endif  // PROBE_STATS_H
@@ -0,0 +1,120 @@
+#include "sketch.h"
+#include <string.h>
+#include "utils.h"
+
+#define SUB_BINS_LOG2 2
+#define SUB_BINS (1 << SUB_BINS_LOG2)
+#define MAX_BINS (64 * SUB_BINS)
+
+// Extra bins allocated on the growing side, so that the bins aren't reallocated on every slightly larger value
+static const int GROWTH_BINS = 2 * SUB_BINS;
+
+static int get_bin(uint64_t value) {
+    if (value == 0) return 0;
+
+    int log2 = 63 - __builtin_clzll(value);
+    int sub_bin = log2 >= SUB_BINS_LOG2 ? (value >> (log2 - SUB_BINS_LOG2)) & (SUB_BINS - 1)
+                                        : (value << (SUB_BINS_LOG2 - log2)) & (SUB_BINS - 1);
+    return log2 * SUB_BINS + sub_bin;
+}
+
+// Returns the middle of the bin
+static uint64_t get_bin_value(int bin) {
+    int log2 = bin / SUB_BINS;
+    int sub_bin = bin % SUB_BINS;
+    // Bin covers [(SUB_BINS + sub_bin) / SUB_BINS * 2^log2, (SUB_BINS + sub_bin + 1) / SUB_BINS * 2^log2)
+    uint64_t width = ((uint64_t) 1 << log2) >> SUB_BINS_LOG2;
+    // Shifted last for the lowest bins, which are narrower than a unit, and first for the highest ones not to overflow
+    uint64_t low = ((uint64_t) 1 << log2)
+                   + (log2 >= SUB_BINS_LOG2 ? width * sub_bin : ((uint64_t) sub_bin << log2) >> SUB_BINS_LOG2);
+    return low + width / 2;
+}
+
+// Grows the bins to cover [from, to)
+static void resize(Sketch *sketch, int from, int to) {
+    int length = to - from;
+    uint64_t *bins = malloc(length * sizeof(*bins));
+    if (bins == NULL) ERROR("out of memory.");
+
+    memset(bins, 0, length * sizeof(*bins));
+    if (sketch->length > 0) {
+        memcpy(bins + sketch->offset - from, sketch->bins, sketch->length * sizeof(*bins));
+    }
+    free(sketch->bins);
+    sketch->bins = bins;
+    sketch->offset = from;
+    sketch->length = length;
+}
+
+static void add_to_bin(Sketch *sketch, int bin, uint64_t count) {
+    if (count == 0) return;
+
+    if (sketch->length == 0) {
+        resize(sketch, bin, MIN(bin + 1 + GROWTH_BINS, MAX_BINS));
+    } else if (bin < sketch->offset) {
+        resize(sketch, MAX(bin - GROWTH_BINS, 0), sketch->offset + sketch->length);
+    } else if (bin >= sketch->offset + sketch->length) {
+        resize(sketch, sketch->offset, MIN(bin + 1 + GROWTH_BINS, MAX_BINS));
+    }
+
+    sketch->bins[bin - sketch->offset] += count;
+    sketch->count += count;
+}
+
+void sketch_add(Sketch *sketch, uint64_t value, uint64_t count) {
+    assert(sketch != NULL);
+    add_to_bin(sketch, get_bin(value), count);
+}
+
+void sketch_merge(Sketch *dst, const Sketch *src) {
+    assert(dst != NULL && src != NULL);
+    if (src->count == 0) return;
+
+    // Both ends first, so that dst grows at most once
+    int first = 0;
+    while (src->bins[first] == 0) first++;
+    int last = src->length - 1;
+    while (src->bins[last] == 0) last--;
+    add_to_bin(dst, src->offset + last, src->bins[last]);
+    if (last != first) add_to_bin(dst, src->offset + first, src->bins[first]);
+    for (int i = first + 1; i < last; i++) add_to_bin(dst, src->offset + i, src->bins[i]);
+}
+
+void sketch_copy(Sketch *dst, const Sketch *src) {
+    assert(dst != NULL && src != NULL);
+
+    if (dst->length < src->length) {
+        free(dst->bins);
+        dst->bins = malloc(src->length * sizeof(*dst->bins));
+        if (dst->bins == NULL && src->length > 0) ERROR("out of memory.");
+    }
+    if (src->length > 0) memcpy(dst->bins, src->bins, src->length * sizeof(*dst->bins));
+    dst->count = src->count;
+    dst->offset = src->offset;
+    dst->length = src->length;
+}
+
+uint64_t sketch_quantile(const Sketch *sketch, double quantile) {
+    assert(sketch != NULL && quantile >= 0 && quantile <= 1);
+    if (sketch->count == 0) return 0;
+
+    uint64_t rank = quantile * (sketch->count - 1);
+    uint64_t seen = 0;
+    for (int i = 0; i < sketch->length; i++) {
+        seen += sketch->bins[i];
+        if (seen > rank) return get_bin_value(sketch->offset + i);
+    }
+    return get_bin_value(sketch->offset + sketch->length - 1);
+}
+
+void sketch_free(Sketch *sketch) {
+    if (sketch == NULL) return;
+    free(sketch->bins);
+    *sketch = (Sketch) {0};
+}
+
+void sketches_truncate(SketchVec *sketches, int from) {
+    assert(sketches != NULL && from >= 0);
+    for (int i = from; i < sketches->length; i++) sketch_free(&sketches->data[i]);
+    sketches->length = MIN(sketches->length, from);
+}
@@ -0,0 +1,34 @@
+#ifndef SKETCH_H
+#define SKETCH_H
+
+#include <stdint.h>
+#include "utils.h"
+
+// Log-linear histogram: 4 bins per power of 2 (~12% relative error) over the whole range of u64.
+// Only the bins between the lowest and the highest value are allocated, they grow in either direction as needed.
+// Sketches own their bins, so they are copied with sketch_copy and freed with sketch_free.
+typedef struct {
+    uint64_t count;
+    int16_t offset;  // bin index of bins[0]
+    int16_t length;
+    uint64_t *bins;
+} Sketch;
+
+VECTOR_TYPEDEF(SketchVec, Sketch);
+
+void sketch_add(Sketch *sketch, uint64_t value, uint64_t count);
+
+void sketch_merge(Sketch *dst, const Sketch *src);
+
+// Reuses dst's bins
+void sketch_copy(Sketch *dst, const Sketch *src);
+
+// Returns 0 if the sketch is empty
+uint64_t sketch_quantile(const Sketch *sketch, double quantile);
+
+void sketch_free(Sketch *sketch);
+
+// Frees the sketches from `from` on and truncates the vector to them
+void sketches_truncate(SketchVec *sketches, int from);
+
+#endif  // SKETCH_H
@@ -0,0 +1,619 @@
+#define _GNU_SOURCE
+#include "stream.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <netdb.h>
+#include <poll.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+#include "address.h"
+
+static const char STREAM_MAGIC[8] = {'E', 'B', 'P', 'F', 'S', 'T', 'R', 'M'};
+static const uint64_t STREAM_VERSION = 1;
+static const char *UNIX_PREFIX = "unix:";
+static const uint64_t NS_IN_S = 1000000000;
+static const uint64_t RECONNECT_INTERVAL_NS = 1000000000;  // 1s
+static const int LISTEN_BACKLOG = 64;
+static const int READ_SIZE = 64 * 1024;
+static const uint64_t MAX_FRAME_SIZE = 64 * 1024 * 1024;  // larger frames are from something else, e.g. HTTP
+static const int MAX_NAME_SIZE = 4096;
+static const uint64_t MAX_NODE_CGROUPS = 1 << 20;  // per node, bounds what a peer can make the viewer allocate
+static const int CONNECT_TIMEOUT_MS = 1000;
+#define ADDRESS_BUFFER_SIZE 256
+
+enum { FRAME_HELLO = 1, FRAME_CGROUP = 2, FRAME_BATCH = 3 };
+
+VECTOR_TYPEDEF(ByteVec, uint8_t);
+VECTOR_TYPEDEF(Uint64Vec, uint64_t);
+
+// Counters of a cgroup as of the last batch
+typedef struct {
+    uint64_t count;
+    uint64_t latency_ns;
+    uint64_t latency_buckets[LATENCY_BUCKETS];
+    uint64_t preempts;
+} SentCounters;
+
+VECTOR_TYPEDEF(SentCountersVec, SentCounters);
+
+typedef struct {
+    char *name;
+    Uint64Vec cgroup_ids;  // agent's index -> viewer's id, 0 if it hasn't been described
+} Node;
+
+VECTOR_TYPEDEF(NodeVec, Node);
+
+typedef struct {
+    int fd;
+    int node_idx;  // -1 until HELLO
+    int64_t ktime_offset_ns;  // from agent's ktime to viewer's
+    uint64_t last_ktime_ns;   // of the agent, of HELLO or the last batch
+    ByteVec input;
+} Connection;
+
+VECTOR_TYPEDEF(ConnectionVec, Connection);
+VECTOR_TYPEDEF(PollfdVec, struct pollfd);
+
+// Bounded view of a frame's payload
+typedef struct {
+    const uint8_t *data;
+    size_t size;
+    size_t offset;
+} Reader;
+
+static uint64_t agent_window_ns = 0;
+static char agent_address[ADDRESS_BUFFER_SIZE];
+static char node_name[HOST_NAME_MAX + 1];
+static int agent_fd = -1;
+static uint64_t last_connect_ns = 0;  // of the last attempt
+static uint64_t window_end_ns = 0;
+static uint64_t last_batch_ktime_ns = 0;
+static int described_cgroups = 0;  // on this connection, they are described in order of index
+static SentCountersVec sent_cgroups = {0};
+static Uint64Vec sent_pairs = {0};  // counts of the graph's preemption pairs
+static ByteVec message = {0};  // frames of one update
+static ByteVec payload = {0};  // of the frame being built
+static ByteVec records = {0};  // of the changed cgroups, they are preceded by their count
+
+static int listen_fd = -1;
+static char unix_path[ADDRESS_BUFFER_SIZE] = "";  // removed on close
+static CgroupNames *viewer_cgroup_names = NULL;
+static uint64_t next_cgroup_id = 1;
+static NodeVec nodes = {0};
+static ConnectionVec connections = {0};
+static PollfdVec pollfds = {0};
+static uint64_t viewer_window_ns = 0;
+static atomic_bool is_viewer_stopped = false;  // set by another thread
+
+static uint64_t get_time_ns(void) {
+    struct timespec ts;
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1) ERROR("unable to get monotonic time.");
+    return ts.tv_sec * NS_IN_S + ts.tv_nsec;
+}
+
+// Doesn't block for longer than CONNECT_TIMEOUT_MS, returns false if connecting failed or timed out
+static bool connect_with_timeout(int fd, const struct sockaddr *addr, socklen_t addr_length) {
+    int flags = fcntl(fd, F_GETFL);
+    if (flags == -1 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1) ERROR("unable to make socket non-blocking.");
+
+    if (connect(fd, addr, addr_length) == -1) {
+        if (errno != EINPROGRESS) return false;
+
+        struct pollfd pollfd = {.fd = fd, .events = POLLOUT};
+        int ret;
+        do {
+            ret = poll(&pollfd, 1, CONNECT_TIMEOUT_MS);
+        } while (ret == -1 && errno == EINTR);
+        if (ret <= 0) return false;
+
+        int error;
+        socklen_t error_length = sizeof(error);
+        if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &error_length) == -1 || error != 0) return false;
+    }
+
+    // Writes of the whole update stay blocking
+    if (fcntl(fd, F_SETFL, flags) == -1) ERROR("unable to make socket blocking.");
+    return true;
+}
+
+// Returns the socket, or -1 if connecting failed
+static int open_socket(const char *address, bool is_listening) {
+    if (strncmp(address, UNIX_PREFIX, strlen(UNIX_PREFIX)) == 0) {
+        const char *path = address + strlen(UNIX_PREFIX);
+        struct sockaddr_un addr = {.sun_family = AF_UNIX};
+        if (strlen(path) >= sizeof(addr.sun_path)) ERROR("socket path \"%s\" is too long.", path);
+        strcpy(addr.sun_path, path);
+
+        int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd == -1) ERROR("unable to create socket.");
+        if (!is_listening) {
+            if (connect_with_timeout(fd, (struct sockaddr *) &addr, sizeof(addr))) return fd;
+            close(fd);
+            return -1;
+        }
+
+        if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) == -1) ERROR("unable to bind to \"%s\".", address);
+        if (listen(fd, LISTEN_BACKLOG) == -1) ERROR("unable to listen on \"%s\".", address);
+        snprintf(unix_path, sizeof(unix_path), "%s", path);
+        return fd;
+    }
+
+    char host[ADDRESS_BUFFER_SIZE];
+    const char *port;
+    split_address(address, host, sizeof(host), &port);
+
+    struct addrinfo hints = {
+        .ai_family = AF_UNSPEC,
+        .ai_socktype = SOCK_STREAM,
+        .ai_flags = is_listening ? AI_PASSIVE : 0,
+    };
+    struct addrinfo *info;
+    if (getaddrinfo(host, port, &hints, &info) != 0) ERROR("unable to resolve \"%s\".", address);
+
+    int fd = socket(info->ai_family, info->ai_socktype | SOCK_CLOEXEC, info->ai_protocol);
+    if (fd == -1) ERROR("unable to create socket.");
+    if (is_listening) {
+        int reuse = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+        if (bind(fd, info->ai_addr, info->ai_addrlen) == -1) ERROR("unable to bind to \"%s\".", address);
+        if (listen(fd, LISTEN_BACKLOG) == -1) ERROR("unable to listen on \"%s\".", address);
+    } else if (!connect_with_timeout(fd, info->ai_addr, info->ai_addrlen)) {
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(info);
+    return fd;
+}
+
+static void put_varint(ByteVec *bytes, uint64_t value) {
+    while (value >= 0x80) {
+        VECTOR_PUSH(bytes, (uint8_t) (value | 0x80));
+        value >>= 7;
+    }
+    VECTOR_PUSH(bytes, (uint8_t) value);
+}
+
+static void put_bytes(ByteVec *bytes, const void *data, size_t size) {
+    for (size_t i = 0; i < size; i++) VECTOR_PUSH(bytes, ((const uint8_t *) data)[i]);
+}
+
+static void put_string(ByteVec *bytes, const char *string) {
+    size_t length = strlen(string);
+    put_varint(bytes, length);
+    put_bytes(bytes, string, length);
+}
+
+// Appends the payload as a frame to the message
+static void put_frame(int type) {
+    VECTOR_PUSH(&message, (uint8_t) type);
+    put_varint(&message, payload.length);
+    put_bytes(&message, payload.data, payload.length);
+    payload.length = 0;
+}
+
+// Returns false if the payload is too short
+static bool get_varint(Reader *reader, uint64_t *value) {
+    *value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (reader->offset == reader->size) return false;
+        uint8_t byte = reader->data[reader->offset++];
+        *value |= (uint64_t) (byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0) return true;
+    }
+    return false;
+}
+
+// String isn't NUL-terminated, returns false if it doesn't fit
+static bool get_string(Reader *reader, const char **string, int *length) {
+    uint64_t size;
+    if (!get_varint(reader, &size) || size > reader->size - reader->offset || size > (uint64_t) MAX_NAME_SIZE) {
+        return false;
+    }
+    *string = (const char *) reader->data + reader->offset;
+    *length = size;
+    reader->offset += size;
+    return true;
+}
+
+void start_stream_agent(const char *address, uint64_t window_ns) {
+    assert(address != NULL && window_ns > 0);
+    snprintf(agent_address, sizeof(agent_address), "%s", address);
+    agent_window_ns = window_ns;
+    if (gethostname(node_name, sizeof(node_name)) == -1) ERROR("unable to get hostname.");
+    node_name[sizeof(node_name) - 1] = '\0';
+    window_end_ns = get_time_ns() + window_ns;
+}
+
+void wait_stream_window(void) {
+    struct timespec ts = {
+        .tv_sec = window_end_ns / NS_IN_S,
+        .tv_nsec = window_end_ns % NS_IN_S,
+    };
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+
+    // Windows which were missed, e.g. while connecting, are skipped
+    uint64_t now = get_time_ns();
+    if (now >= window_end_ns) window_end_ns += ((now - window_end_ns) / agent_window_ns + 1) * agent_window_ns;
+}
+
+static void connect_agent(uint64_t now) {
+    if (now - last_connect_ns < RECONNECT_INTERVAL_NS && last_connect_ns != 0) return;
+    last_connect_ns = now;
+
+    agent_fd = open_socket(agent_address, false);
+    if (agent_fd == -1) return;
+
+    put_bytes(&payload, STREAM_MAGIC, sizeof(STREAM_MAGIC));
+    put_varint(&payload, STREAM_VERSION);
+    put_varint(&payload, now);
+    put_varint(&payload, agent_window_ns);
+    put_string(&payload, node_name);
+    put_frame(FRAME_HELLO);
+
+    last_batch_ktime_ns = now;
+    described_cgroups = 0;
+}
+
+// Returns false if the viewer is gone
+static bool write_message(void) {
+    size_t offset = 0;
+    while (offset < (size_t) message.length) {
+        ssize_t bytes = send(agent_fd, message.data + offset, message.length - offset, MSG_NOSIGNAL);
+        if (bytes == -1 && errno == EINTR) continue;
+        if (bytes <= 0) return false;
+        offset += bytes;
+    }
+    return true;
+}
+
+// Appends changes of the cgroup's counters to the records and catches up the sent ones, returns false if there are none
+static bool put_cgroup_changes(ByteVec *records, const Cgroup *cgroup, SentCounters *sent, int idx_delta) {
+    if (cgroup->entries_count == sent->count && cgroup->entries_preempts == sent->preempts) return false;
+
+    uint32_t buckets_mask = 0;
+    for (int i = 0; i < LATENCY_BUCKETS; i++) {
+        if (cgroup->entries_latency_buckets[i] != sent->latency_buckets[i]) buckets_mask |= 1U << i;
+    }
+
+    put_varint(records, idx_delta);
+    put_varint(records, cgroup->entries_count - sent->count);
+    put_varint(records, cgroup->entries_latency_ns - sent->latency_ns);
+    put_varint(records, cgroup->entries_preempts - sent->preempts);
+    put_varint(records, buckets_mask);
+    for (int i = 0; i < LATENCY_BUCKETS; i++) {
+        if (buckets_mask & (1U << i)) {
+            put_varint(records, cgroup->entries_latency_buckets[i] - sent->latency_buckets[i]);
+        }
+    }
+
+    sent->count = cgroup->entries_count;
+    sent->latency_ns = cgroup->entries_latency_ns;
+    memcpy(sent->latency_buckets, cgroup->entries_latency_buckets, sizeof(sent->latency_buckets));
+    sent->preempts = cgroup->entries_preempts;
+    return true;
+}
+
+void send_stream(const Graph *graph) {
+    assert(graph != NULL && agent_window_ns > 0);
+
+    uint64_t now = get_time_ns();
+    message.length = 0;
+    if (agent_fd == -1) connect_agent(now);
+
+    const CgroupVec *cgroups = &graph->cgroups;
+    if (agent_fd != -1) {
+        for (int i = described_cgroups; i < cgroups->length; i++) {
+            put_varint(&payload, i);
+            put_string(&payload, cgroups->data[i].name);
+            put_frame(FRAME_CGROUP);
+        }
+        described_cgroups = cgroups->length;
+    }
+
+    // Sent counters are caught up even while disconnected, so changes in between are dropped
+    records.length = 0;
+    int changed_cgroups = 0;
+    int last_idx = 0;
+    while (sent_cgroups.length < cgroups->length) VECTOR_PUSH(&sent_cgroups, (SentCounters) {0});
+    for (int i = 0; i < cgroups->length; i++) {
+        if (put_cgroup_changes(&records, &cgroups->data[i], &sent_cgroups.data[i], i - last_idx)) {
+            changed_cgroups++;
+            last_idx = i;
+        }
+    }
+
+    const PreemptionPairVec *pairs = &graph->preemption_pairs;
+    while (sent_pairs.length < pairs->length) VECTOR_PUSH(&sent_pairs, 0);
+    int changed_pairs = 0;
+    for (int i = 0; i < pairs->length; i++) changed_pairs += pairs->data[i].count != sent_pairs.data[i];
+
+    // Batch is of the window which has just ended, empty ones aren't sent
+    uint64_t window_start_ns = now - agent_window_ns;
+    if (agent_fd != -1 && (changed_cgroups > 0 || changed_pairs > 0)) {
+        window_start_ns = MAX(window_start_ns, last_batch_ktime_ns);
+        put_varint(&payload, window_start_ns - last_batch_ktime_ns);
+        put_varint(&payload, graph->max_time_s);
+        put_varint(&payload, changed_cgroups);
+        put_bytes(&payload, records.data, records.length);
+        put_varint(&payload, changed_pairs);
+        for (int i = 0; i < pairs->length; i++) {
+            const PreemptionPair *pair = &pairs->data[i];
+            if (pair->count == sent_pairs.data[i]) continue;
+
+            put_varint(&payload, pair->victim_idx);
+            put_varint(&payload, pair->aggressor_idx);
+            put_varint(&payload, pair->count - sent_pairs.data[i]);
+        }
+        put_frame(FRAME_BATCH);
+        last_batch_ktime_ns = window_start_ns;
+    }
+    for (int i = 0; i < pairs->length; i++) sent_pairs.data[i] = pairs->data[i].count;
+
+    // Whole update goes out in one write
+    if (agent_fd != -1 && message.length > 0 && !write_message()) {
+        close(agent_fd);
+        agent_fd = -1;
+    }
+}
+
+void close_stream_agent(void) {
+    if (agent_fd != -1) close(agent_fd);
+    agent_fd = -1;
+    VECTOR_FREE(&sent_cgroups);
+    VECTOR_FREE(&sent_pairs);
+    VECTOR_FREE(&message);
+    VECTOR_FREE(&payload);
+    VECTOR_FREE(&records);
+}
+
+void start_stream_viewer(const char *address, CgroupNames *cgroup_names) {
+    assert(address != NULL && cgroup_names != NULL);
+    listen_fd = open_socket(address, true);
+    viewer_cgroup_names = cgroup_names;
+}
+
+static void close_connection(int idx) {
+    close(connections.data[idx].fd);
+    VECTOR_FREE(&connections.data[idx].input);
+    connections.data[idx] = connections.data[--connections.length];
+}
+
+// Returns false if the frame is malformed
+static bool read_hello(Connection *connection, Reader *reader) {
+    if (connection->node_idx != -1) return false;
+    if (reader->size < sizeof(STREAM_MAGIC) || memcmp(reader->data, STREAM_MAGIC, sizeof(STREAM_MAGIC)) != 0) {
+        return false;
+    }
+    reader->offset = sizeof(STREAM_MAGIC);
+
+    uint64_t version, ktime_ns, window_ns;
+    const char *name;
+    int name_length;
+    if (!get_varint(reader, &version) || version != STREAM_VERSION || !get_varint(reader, &ktime_ns)
+        || !get_varint(reader, &window_ns) || window_ns == 0 || !get_string(reader, &name, &name_length)) {
+        return false;
+    }
+
+    // Agent's clock is matched to this one, off by the time it took to send the frame
+    connection->ktime_offset_ns = (int64_t) (get_time_ns() - ktime_ns);
+    connection->last_ktime_ns = ktime_ns;
+    viewer_window_ns = MAX(viewer_window_ns, window_ns);
+
+    for (int i = 0; i < nodes.length; i++) {
+        if ((int) strlen(nodes.data[i].name) == name_length && strncmp(nodes.data[i].name, name, name_length) == 0) {
+            connection->node_idx = i;
+            return true;
+        }
+    }
+
+    Node node = {.name = strndup(name, name_length)};
+    if (node.name == NULL) ERROR("out of memory.");
+    VECTOR_PUSH(&nodes, node);
+    connection->node_idx = nodes.length - 1;
+    return true;
+}
+
+static bool read_cgroup(Connection *connection, Reader *reader) {
+    if (connection->node_idx == -1) return false;
+    Node *node = &nodes.data[connection->node_idx];
+
+    uint64_t idx;
+    const char *name;
+    int name_length;
+    if (!get_varint(reader, &idx) || !get_string(reader, &name, &name_length)) return false;
+    // Cgroups are described in order of index, so a frame can add at most one
+    if (idx > (uint64_t) node->cgroup_ids.length || idx >= MAX_NODE_CGROUPS) return false;
+
+    char full_name[HOST_NAME_MAX + MAX_NAME_SIZE + 2];
+    snprintf(full_name, sizeof(full_name), "%s:%.*s", node->name, name_length, name);
+
+    // Reconnected agent describes its cgroups again, they are the same ones unless it was restarted
+    if (idx == (uint64_t) node->cgroup_ids.length) VECTOR_PUSH(&node->cgroup_ids, 0);
+    uint64_t id = node->cgroup_ids.data[idx];
+    if (id != 0 && strcmp(get_cgroup_info(viewer_cgroup_names, id)->name, full_name) == 0) return true;
+
+    id = next_cgroup_id++;
+    add_cgroup_info(viewer_cgroup_names, id, full_name, false);
+    node->cgroup_ids.data[idx] = id;
+    return true;
+}
+
+static bool get_cgroup_id(const Node *node, uint64_t idx, uint64_t *id) {
+    if (idx >= (uint64_t) node->cgroup_ids.length || node->cgroup_ids.data[idx] == 0) return false;
+    *id = node->cgroup_ids.data[idx];
+    return true;
+}
+
+static bool read_batch(Connection *connection, Reader *reader, BatchVec *batches, PreemptionCountVec *preemptions) {
+    if (connection->node_idx == -1) return false;
+    const Node *node = &nodes.data[connection->node_idx];
+
+    uint64_t ktime_delta_ns, time_s, cgroups_count;
+    if (!get_varint(reader, &ktime_delta_ns) || !get_varint(reader, &time_s) || !get_varint(reader, &cgroups_count)) {
+        return false;
+    }
+    connection->last_ktime_ns += ktime_delta_ns;
+    uint64_t ktime_ns = connection->last_ktime_ns + connection->ktime_offset_ns;
+
+    uint64_t idx = 0;
+    for (uint64_t i = 0; i < cgroups_count; i++) {
+        uint64_t idx_delta, count, total_latency_ns, preempts, buckets_mask;
+        if (!get_varint(reader, &idx_delta) || !get_varint(reader, &count) || !get_varint(reader, &total_latency_ns)
+            || !get_varint(reader, &preempts) || !get_varint(reader, &buckets_mask)) {
+            return false;
+        }
+        // Counters of a window are 32-bit, anything larger is malformed
+        if (count > UINT32_MAX || preempts > UINT32_MAX) return false;
+        idx += idx_delta;
+
+        Batch batch = {
+            .time_s = time_s,
+            .ktime_ns = ktime_ns,
+            .cpu = UNKNOWN_CPU,
+            .total_latency_ns = total_latency_ns,
+            .count = count,
+            .preempts = preempts,
+        };
+        if (!get_cgroup_id(node, idx, &batch.cgroup_id)) return false;
+        for (int j = 0; j < LATENCY_BUCKETS; j++) {
+            uint64_t bucket = 0;
+            if ((buckets_mask & (1U << j)) && (!get_varint(reader, &bucket) || bucket > UINT32_MAX)) return false;
+            batch.latency_buckets[j] = bucket;
+        }
+
+        // Batches with no events only carry preemptions
+        if (count > 0) VECTOR_PUSH(batches, batch);
+    }
+
+    uint64_t pairs_count;
+    if (!get_varint(reader, &pairs_count)) return false;
+    for (uint64_t i = 0; i < pairs_count; i++) {
+        uint64_t victim_idx, aggressor_idx;
+        PreemptionCount preemption;
+        if (!get_varint(reader, &victim_idx) || !get_varint(reader, &aggressor_idx)
+            || !get_varint(reader, &preemption.count) || !get_cgroup_id(node, victim_idx, &preemption.victim_cgroup_id)
+            || !get_cgroup_id(node, aggressor_idx, &preemption.aggressor_cgroup_id)) {
+            return false;
+        }
+        VECTOR_PUSH(preemptions, preemption);
+    }
+    return true;
+}
+
+// Handles the complete frames in the input, returns false if the connection must be closed
+static bool read_frames(Connection *connection, BatchVec *batches, PreemptionCountVec *preemptions) {
+    size_t offset = 0;
+    while (offset < (size_t) connection->input.length) {
+        Reader header = {
+            .data = connection->input.data + offset + 1,
+            .size = connection->input.length - offset - 1,
+        };
+        uint64_t size;
+        if (!get_varint(&header, &size)) {
+            if (header.offset >= 10) return false;
+            break;
+        }
+        if (size > MAX_FRAME_SIZE) return false;
+        if (size > header.size - header.offset) break;
+
+        int type = connection->input.data[offset];
+        Reader reader = {
+            .data = header.data + header.offset,
+            .size = size,
+        };
+        bool is_valid = true;
+        if (type == FRAME_HELLO) is_valid = read_hello(connection, &reader);
+        else if (type == FRAME_CGROUP) is_valid = read_cgroup(connection, &reader);
+        else if (type == FRAME_BATCH) is_valid = read_batch(connection, &reader, batches, preemptions);
+        else is_valid = connection->node_idx != -1;  // unknown frames are skipped, but only after HELLO
+        if (!is_valid) return false;
+
+        offset += 1 + header.offset + size;
+    }
+
+    memmove(connection->input.data, connection->input.data + offset, connection->input.length - offset);
+    connection->input.length -= offset;
+    return true;
+}
+
+// Returns false if the connection must be closed
+static bool read_connection(Connection *connection, BatchVec *batches, PreemptionCountVec *preemptions) {
+    ByteVec *input = &connection->input;
+    if (input->capacity - input->length < READ_SIZE) {
+        input->capacity = MAX(input->capacity * 2, input->length + READ_SIZE);
+        input->data = realloc(input->data, input->capacity);
+        if (input->data == NULL) ERROR("out of memory.");
+    }
+
+    ssize_t bytes = read(connection->fd, input->data + input->length, input->capacity - input->length);
+    if (bytes == -1 && errno == EINTR) return true;
+    if (bytes <= 0) return false;
+    input->length += bytes;
+
+    // Malformed frame drops the whole connection, together with whatever it has sent in this read
+    int batches_length = batches->length;
+    int preemptions_length = preemptions->length;
+    if (read_frames(connection, batches, preemptions)) return true;
+    batches->length = batches_length;
+    preemptions->length = preemptions_length;
+    return false;
+}
+
+int read_stream(BatchVec *batches, PreemptionCountVec *preemptions, int timeout_ms) {
+    assert(batches != NULL && preemptions != NULL && listen_fd != -1);
+    if (is_viewer_stopped) return -1;
+
+    pollfds.length = 0;
+    VECTOR_PUSH(&pollfds, ((struct pollfd) {.fd = listen_fd, .events = POLLIN}));
+    for (int i = 0; i < connections.length; i++) {
+        VECTOR_PUSH(&pollfds, ((struct pollfd) {.fd = connections.data[i].fd, .events = POLLIN}));
+    }
+
+    int ret = poll(pollfds.data, pollfds.length, timeout_ms);
+    if (ret == -1 && errno != EINTR) ERROR("unable to poll stream's sockets.");
+    if (ret <= 0) return 0;
+
+    // Connections are removed by swapping with the last one, so they are handled from the end
+    for (int i = connections.length - 1; i >= 0; i--) {
+        if (pollfds.data[i + 1].revents == 0) continue;
+        if (!read_connection(&connections.data[i], batches, preemptions)) close_connection(i);
+    }
+
+    if (pollfds.data[0].revents & POLLIN) {
+        int fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+        if (fd != -1) {
+            Connection connection = {
+                .fd = fd,
+                .node_idx = -1,
+            };
+            VECTOR_PUSH(&connections, connection);
+        }
+    }
+
+    return 0;
+}
+
+uint64_t get_stream_window_ns(void) { return viewer_window_ns; }
+
+void stop_stream_viewer(void) { is_viewer_stopped = true; }
+
+void close_stream_viewer(void) {
+    if (listen_fd != -1) close(listen_fd);
+    listen_fd = -1;
+    if (unix_path[0] != '\0') unlink(unix_path);
+
+    while (connections.length > 0) close_connection(connections.length - 1);
+    VECTOR_FREE(&connections);
+    for (int i = 0; i < nodes.length; i++) {
+        free(nodes.data[i].name);
+        VECTOR_FREE(&nodes.data[i].cgroup_ids);
+    }
+    VECTOR_FREE(&nodes);
+    VECTOR_FREE(&pollfds);
+}
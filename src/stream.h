@@ -0,0 +1,47 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include "aggregate.h"
+
+// Agents send what their graphs gained over each window to a viewer, which merges the nodes into one graph.
+// Stream is a sequence of frames, each one is a type, varint payload size and payload, starting with HELLO:
+//   HELLO  - magic, version, agent's ktime, window and node name
+//   CGROUP - agent's index of a cgroup and its name, in order of index, precedes the first batch with it
+//   BATCH  - ktime delta from the previous batch, time of day and what changed since it: cgroups by index delta with
+//            count, total latency, preemptions and non-zero latency buckets, then preemption pairs
+// Integers are LEB128 varints, so the format doesn't depend on byte order.
+// Address is "[host:]port" (localhost by default, IPv6 hosts in brackets) or "unix:path".
+
+// Window of the agents without aggregation in the kernel, it's also the finest granularity of the viewer
+#define STREAM_WINDOW_NS 100000000ULL  // 100ms
+
+// Agent connects lazily, waiting at most a second, and reconnects when the viewer is gone, whatever happens in between
+// is dropped.
+// Node is named by its hostname.
+void start_stream_agent(const char *address, uint64_t window_ns);
+
+// Sleeps until the end of the current window, returns early on signals
+void wait_stream_window(void);
+
+// Sends changes of the graph's cumulative counters since the last call, the graph must be synced with the same one
+void send_stream(const Graph *graph);
+
+void close_stream_agent(void);
+
+// Cgroups are added to cgroup_names as their agents describe them, named "node:cgroup" and with ids assigned by the
+// viewer, so it must outlive the stream. Agents which reconnect with the same node name keep their cgroups.
+void start_stream_viewer(const char *address, CgroupNames *cgroup_names);
+
+// Same as read_batches, appends what the agents have sent, waiting up to timeout_ms for it. Batches are of the whole
+// window with UNKNOWN_CPU, and preemptions are those of the window. Returns -1 once the stream has been stopped.
+int read_stream(BatchVec *batches, PreemptionCountVec *preemptions, int timeout_ms);
+
+// Largest window of the agents which have connected
+uint64_t get_stream_window_ns(void);
+
+// Can be called from any thread
+void stop_stream_viewer(void);
+
+void close_stream_viewer(void);
+
+#endif  // STREAM_H
@@ -0,0 +1,50 @@
+#ifndef UTILS_H
+#define UTILS_H
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define ERROR(...)                    \
+    do {                              \
+        fprintf(stderr, "ERROR: ");   \
+        fprintf(stderr, __VA_ARGS__); \
+        fprintf(stderr, "\n");        \
+        exit(EXIT_FAILURE);           \
+    } while (0)
+
+#define INITIAL_VECTOR_CAPACITY 16
+
+#define VECTOR_TYPEDEF(name, type) \
+    typedef struct {               \
+        int capacity;              \
+        int length;                \
+        type *data;                \
+    } name
+
+#define VECTOR_PUSH(vec, element)                                                       \
+    do {                                                                                \
+        assert((vec) != NULL);                                                          \
+        if ((vec)->capacity == 0) {                                                     \
+            (vec)->capacity = INITIAL_VECTOR_CAPACITY;                                  \
+            (vec)->data = malloc((vec)->capacity * sizeof(*(vec)->data));               \
+            if ((vec)->data == NULL) ERROR("out of memory.");                           \
+        } else if ((vec)->capacity == (vec)->length) {                                  \
+            (vec)->capacity *= 2;                                                       \
+            (vec)->data = realloc((vec)->data, (vec)->capacity * sizeof(*(vec)->data)); \
+            if ((vec)->data == NULL) ERROR("out of memory.");                           \
+        }                                                                               \
+        (vec)->data[(vec)->length++] = (element);                                       \
+    } while (0)
+
+#define VECTOR_LAST(vec) ((vec)->length > 0 ? &(vec)->data[(vec)->length - 1] : NULL)
+
+#define VECTOR_FREE(vec)                                             \
+    do {                                                             \
+        if ((vec) != NULL && (vec)->data != NULL) free((vec)->data); \
+    } while (0)
+
+#define MAX(a, b) ((a) >= (b) ? (a) : (b))
+#define MIN(a, b) ((a) <= (b) ? (a) : (b))
+
+#endif  // UTILS_H
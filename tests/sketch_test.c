@@ -0,0 +1,100 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "sketch.h"
+
+// Bins are a quarter of a power of 2 wide and quantiles are their middles
+static const double MAX_RELATIVE_ERROR = 0.125;
+
+static int failures = 0;
+
+static void expect_close(const char *name, uint64_t actual, uint64_t expected) {
+    double error = actual > expected ? actual - expected : expected - actual;
+    if (error <= expected * MAX_RELATIVE_ERROR) return;
+
+    fprintf(stderr, "FAIL: %s is %lu, expected ~%lu\n", name, actual, expected);
+    failures++;
+}
+
+// Most events are fast and a few are orders of magnitude slower, as with runqueue latency under contention
+static void test_mixed_magnitudes(void) {
+    Sketch sketch = {0};
+    sketch_add(&sketch, 3000, 990);
+    sketch_add(&sketch, 10000000, 10);
+
+    expect_close("p50 of mixed magnitudes", sketch_quantile(&sketch, 0.5), 3000);
+    expect_close("p99 of mixed magnitudes", sketch_quantile(&sketch, 0.99), 3000);
+    expect_close("p99.9 of mixed magnitudes", sketch_quantile(&sketch, 0.999), 10000000);
+    sketch_free(&sketch);
+}
+
+// Values added in increasing order grow the bins upward, in decreasing order downward
+static void test_growth(void) {
+    Sketch up = {0};
+    Sketch down = {0};
+    for (int i = 0; i < 40; i++) {
+        sketch_add(&up, 1ULL << i, 1);
+        sketch_add(&down, 1ULL << (39 - i), 1);
+    }
+
+    expect_close("min of growing up", sketch_quantile(&up, 0), 1);
+    expect_close("max of growing up", sketch_quantile(&up, 1), 1ULL << 39);
+    expect_close("min of growing down", sketch_quantile(&down, 0), 1);
+    expect_close("max of growing down", sketch_quantile(&down, 1), 1ULL << 39);
+    expect_close("p50 of growing down", sketch_quantile(&down, 0.5), 1ULL << 19);
+    sketch_free(&up);
+    sketch_free(&down);
+}
+
+// Merged sketches are the same as one of all values, including the extremes of u64
+static void test_merge(void) {
+    Sketch low = {0};
+    Sketch high = {0};
+    Sketch all = {0};
+    sketch_add(&low, 1, 500);
+    sketch_add(&high, UINT64_MAX, 500);
+    sketch_add(&all, 1, 500);
+    sketch_add(&all, UINT64_MAX, 500);
+
+    Sketch merged = {0};
+    sketch_copy(&merged, &high);
+    sketch_merge(&merged, &low);
+    for (int i = 0; i <= 10; i++) {
+        double quantile = i / 10.0;
+        if (sketch_quantile(&merged, quantile) != sketch_quantile(&all, quantile)) {
+            fprintf(stderr, "FAIL: merged quantile %.1f differs\n", quantile);
+            failures++;
+        }
+    }
+    expect_close("max of u64", sketch_quantile(&merged, 1), UINT64_MAX);
+    sketch_free(&low);
+    sketch_free(&high);
+    sketch_free(&all);
+    sketch_free(&merged);
+}
+
+// Counts of merged sketches, e.g. of the root cgroup over hours, don't fit 32 bits
+static void test_large_counts(void) {
+    Sketch sketch = {0};
+    sketch_add(&sketch, 1000, 3000000000ULL);
+    sketch_add(&sketch, 1000000, 3000000000ULL);
+
+    if (sketch.count != 6000000000ULL) {
+        fprintf(stderr, "FAIL: count is %lu, expected 6000000000\n", sketch.count);
+        failures++;
+    }
+    expect_close("p25 of large counts", sketch_quantile(&sketch, 0.25), 1000);
+    expect_close("p75 of large counts", sketch_quantile(&sketch, 0.75), 1000000);
+    sketch_free(&sketch);
+}
+
+int main(void) {
+    test_mixed_magnitudes();
+    test_growth();
+    test_merge();
+    test_large_counts();
+
+    if (failures > 0) return EXIT_FAILURE;
+    printf("sketch: all tests passed\n");
+    return EXIT_SUCCESS;
+}